@@ -0,0 +1,65 @@
+// Times the two vertical passes of the transposed blur's comparison on
+// frames 2160 rows tall and 3840, 7680 and 15360 pixels wide: blur_strided,
+// whose column pass walks down the columns of the row totals directly, and
+// blur_transposed, which slides along the rows of a transpose instead. Both
+// share the sliding row pass and give the same bytes; blur_sliding is shown
+// for reference. Prints the best of several runs of each, in milliseconds.
+//
+// Usage: transposed_blur [radius] [runs] [channels]   (5, 3 and 3 by default)
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include "blur.hpp"
+
+template <typename F>
+static double best_of(const int runs, F blur_pass)
+{
+  double best = 0;
+  for (int i = 0; i < runs; ++i) {
+    const auto start = std::chrono::steady_clock::now();
+    blur_pass();
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (i == 0 || ms < best) best = ms;
+  }
+  return best;
+}
+
+int main(int argc, char *argv[])
+{
+  const int radius = argc > 1 ? std::atoi(argv[1]) : 5;
+  const int runs = argc > 2 ? std::atoi(argv[2]) : 3;
+  const unsigned nchannels = argc > 3 ? std::atoi(argv[3]) : 3;
+  if (radius < 1 || runs < 1 || nchannels < 1) {
+    std::fprintf(stderr, "usage: %s [radius] [runs] [channels]\n", argv[0]);
+    return 1;
+  }
+
+  const unsigned h = 2160;
+  std::printf("radius %d, %u channels, %s row kernels, best of %d (ms)\n",
+              radius, nchannels, simd_tier_name(active_row_kernels().tier), runs);
+  std::printf("%12s %10s %12s %10s\n", "frame", "strided", "transposed", "sliding");
+  for (const unsigned w : { 3840u, 7680u, 15360u }) {
+    image_buffer in(std::size_t(w)*h*nchannels), strided(in.size()), transposed(in.size()), sliding(in.size());
+    std::mt19937 random(w);
+    for (unsigned char &byte : in) byte = (unsigned char)random();
+
+    const double strided_ms = best_of(runs, [&] {
+      blur(strided.data(), in.data(), radius, w, h, nchannels, blur_method::strided); });
+    const double transposed_ms = best_of(runs, [&] {
+      blur(transposed.data(), in.data(), radius, w, h, nchannels, blur_method::transposed); });
+    const double sliding_ms = best_of(runs, [&] {
+      blur(sliding.data(), in.data(), radius, w, h, nchannels, blur_method::sliding); });
+    if (strided != sliding || transposed != sliding) {
+      std::fprintf(stderr, "%ux%u: the blurs disagree\n", w, h);
+      return 1;
+    }
+
+    char frame[32];
+    std::snprintf(frame, sizeof frame, "%ux%u", w, h);
+    std::printf("%12s %10.1f %12.1f %10.1f\n", frame, strided_ms, transposed_ms, sliding_ms);
+  }
+  return 0;
+}
@@ -1,43 +1,963 @@
 #ifndef _BLUR_HPP_
 #define _BLUR_HPP_
 
+#include <vector>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <climits>
+#include "row_kernels.hpp"
+#include "image_buffer.hpp"
+#include "transpose.hpp"
+
+// How a window total is turned into an average: truncate matches the float
+// division the blur originally used, nearest rounds to the closest value.
+// nsamples is odd, so there are never ties.
+enum class blur_rounding { truncate, nearest };
+
+// Divides window totals by nsamples with a precomputed multiply and shift:
+// average = ((total + bias) * multiplier) >> shift. With bits the smallest
+// power of two covering nsamples, shift = 8 + 2*bits and
+// multiplier = ceil(2^shift / nsamples) make the result exactly
+// floor((total + bias) / nsamples) for any total of nsamples bytes. The
+// same three values are passed to the OpenCL kernels, so the host and
+// device averages are bit-identical.
+struct box_divisor {
+  box_divisor(const unsigned nsamples,
+              const blur_rounding rounding = blur_rounding::truncate)
+  {
+    unsigned bits = 0;
+    while ((1u << bits) < nsamples) ++bits;
+    assert(bits <= 23); // keeps the product within 64 bits
+    shift = 8 + 2*bits;
+    multiplier = ((uint64_t(1) << shift) + nsamples - 1) / nsamples;
+    bias = rounding == blur_rounding::nearest ? nsamples/2 : 0;
+  }
+
+  unsigned char operator()(const unsigned total) const
+  {
+    return (unsigned char)((uint64_t(total + bias) * multiplier) >> shift);
+  }
+
+  uint64_t multiplier;
+  unsigned bias, shift;
+};
+
+// The number of pixels in the square window of blur_radius.
+constexpr unsigned box_samples(const int blur_radius)
+{
+  return (blur_radius*2-1) * (blur_radius*2-1);
+}
+
+// Divides window totals by a compile-time NSAMPLES, which the compiler turns
+// into its own multiply and shift. Like box_divisor, it gives exactly
+// floor((total + bias) / NSAMPLES).
+template <unsigned NSAMPLES>
+struct fixed_divisor {
+  explicit fixed_divisor(const blur_rounding rounding)
+    : bias(rounding == blur_rounding::nearest ? NSAMPLES/2 : 0) {}
+
+  unsigned char operator()(const unsigned total) const
+  {
+    return (unsigned char)((total + bias) / NSAMPLES);
+  }
+
+  unsigned bias;
+};
+
+// Calls f(0), f(1), ... f(N-1) as straight-line code. GCC does not unroll
+// even short loops of a constant trip count at -O2.
+template <int N>
+struct unroll {
+  template <typename F> static void apply(const F &f) { unroll<N-1>::apply(f); f(N-1); }
+};
+
+template <>
+struct unroll<0> {
+  template <typename F> static void apply(const F &) {}
+};
+
+// The kernels below are templates on NCHANNELS, the channel count as a
+// compile-time constant, so their channel loops unroll into straight-line
+// code. They are instantiated for grayscale (1), RGB (3) and RGBA/RGBX (4);
+// NCHANNELS = 0 takes the count from the nchannels argument instead, for
+// any other image. Their callers pick the instantiation with a switch on
+// nchannels.
+const unsigned max_channels = 16; // for NCHANNELS = 0
+
+// Adds the channels of a pixel into totals. The common counts are written
+// out so the totals stay in registers rather than in a looped-over array.
+template <unsigned NCHANNELS>
+inline void add_pixel(unsigned *totals, const unsigned char *pixel,
+                      const unsigned nchannels)
+{
+  for (unsigned c = 0; c < nchannels; ++c)
+    totals[c] += pixel[c];
+}
+
+template <>
+inline void add_pixel<1>(unsigned *totals, const unsigned char *pixel, unsigned)
+{
+  totals[0] += pixel[0];
+}
+
+template <>
+inline void add_pixel<3>(unsigned *totals, const unsigned char *pixel, unsigned)
+{
+  totals[0] += pixel[0];
+  totals[1] += pixel[1];
+  totals[2] += pixel[2];
+}
+
+template <>
+inline void add_pixel<4>(unsigned *totals, const unsigned char *pixel, unsigned)
+{
+  totals[0] += pixel[0];
+  totals[1] += pixel[1];
+  totals[2] += pixel[2];
+  totals[3] += pixel[3];
+}
+
+// Replicates the border: maps an index outside [0,n) onto the nearest edge.
+inline unsigned clamp_index(const int i, const unsigned n)
+{
+  return i < 0 ? 0 : i >= (int)n ? n-1 : i;
+}
+
+// How the window of a pixel near the edge is filled past the image:
+// replicate repeats the edge pixel (aaa|abcd), reflect mirrors the image
+// about it (dcb|abcd), wrap continues from the opposite edge (bcd|abcd) and
+// constant reads zeros. Only the naive blur, on the host and the device,
+// implements the modes other than replicate; the other blurs always
+// replicate. The values are those of BORDER_MODE in blur.cl.
+enum class blur_border { replicate = 0, reflect = 1, wrap = 2, constant = 3 };
+
+// Maps index i of a row or column of n pixels into [0,n) as border fills
+// it, or returns -1 where the constant border reads a zero.
+inline int border_index(int i, const unsigned n, const blur_border border)
+{
+  if (i >= 0 && i < (int)n) return i;
+  switch (border) {
+    case blur_border::replicate:
+      return clamp_index(i, n);
+    case blur_border::reflect: {
+      if (n == 1) return 0;
+      const int period = 2*((int)n-1);
+      i %= period;
+      if (i < 0) i += period;
+      return i < (int)n ? i : period-i;
+    }
+    case blur_border::wrap:
+      i %= (int)n;
+      return i < 0 ? i+n : i;
+    case blur_border::constant:
+      return -1;
+  }
+  return clamp_index(i, n);
+}
+
+// The pixels [begin,end) of a row or column of n pixels whose windows,
+// reaching reach pixels either side, lie wholly inside it. When there are
+// none, begin = end = n.
+inline void interior_range(const int reach, const unsigned n, int &begin, int &end)
+{
+  begin = reach; end = (int)n-reach;
+  if (end <= begin) begin = end = n;
+}
+
 // Averages the nsamples pixels within blur_radius of (x,y). Pixels which
-// would be outside the image, replicate the value at the image border.
+// would be outside the image are filled as border says. The totals are
+// accumulated as integers and divided by divide.
+template <unsigned NCHANNELS>
 void pixel_average(      unsigned char *out,
                    const unsigned char *in,
                    const int x, const int y, const int blur_radius,
-                   const unsigned w, const unsigned h, const unsigned nchannels)
+                   const unsigned w, const unsigned h, const unsigned nchannels,
+                   const box_divisor &divide, const blur_border border)
 {
-  float red_total = 0, green_total = 0, blue_total = 0;
+  const unsigned channels = NCHANNELS ? NCHANNELS : nchannels;
+  unsigned totals[NCHANNELS ? NCHANNELS : max_channels] = {};
+  assert(channels <= sizeof(totals)/sizeof(totals[0]));
 
   for (int j = y-blur_radius+1; j < y+blur_radius; ++j) {
+    const int r_j = border_index(j, h, border);
+    if (r_j < 0) continue;
+    const unsigned char *row = in + r_j*w*channels;
     for (int i = x-blur_radius+1; i < x+blur_radius; ++i) {
-      const unsigned r_i = i < 0 ? 0 : i >= w ? w-1 : i;
+      const int r_i = border_index(i, w, border);
+      if (r_i < 0) continue;
 
-      const unsigned r_j = j < 0 ? 0 : j >= h ? h-1 : j;
-      unsigned byte_offset = (r_j*w+r_i)*nchannels;
-      red_total   += in[byte_offset+0];
-      green_total += in[byte_offset+1];
-      blue_total  += in[byte_offset+2];
+      add_pixel<NCHANNELS>(totals, row + r_i*channels, channels);
     }
   }
 
-  const unsigned nsamples = (blur_radius*2-1) * (blur_radius*2-1);
-  unsigned byte_offset = (y*w+x)*nchannels;
-  out[byte_offset+0] =   red_total/nsamples;
-  out[byte_offset+1] = green_total/nsamples;
-  out[byte_offset+2] =  blue_total/nsamples;
+  unsigned byte_offset = (y*w+x)*channels;
+  for (unsigned c = 0; c < channels; ++c)
+    out[byte_offset+c] = divide(totals[c]);
 }
 
+// pixel_average() of a pixel whose window lies wholly inside the image, so
+// no sample needs a border check.
+template <unsigned NCHANNELS>
+void interior_average(      unsigned char *out,
+                      const unsigned char *in,
+                      const int x, const int y, const int blur_radius,
+                      const unsigned w, const unsigned nchannels,
+                      const box_divisor &divide)
+{
+  const unsigned channels = NCHANNELS ? NCHANNELS : nchannels;
+  unsigned totals[NCHANNELS ? NCHANNELS : max_channels] = {};
+  assert(channels <= sizeof(totals)/sizeof(totals[0]));
+
+  const unsigned window = 2*blur_radius-1;
+  const unsigned char *row = in + ((y-blur_radius+1)*w + x-blur_radius+1)*channels;
+  for (unsigned j = 0; j < window; ++j, row += w*channels)
+    for (unsigned i = 0; i < window*channels; i += channels)
+      add_pixel<NCHANNELS>(totals, row + i, channels);
+
+  unsigned byte_offset = (y*w+x)*channels;
+  for (unsigned c = 0; c < channels; ++c)
+    out[byte_offset+c] = divide(totals[c]);
+}
+
+// Runs average(x, y) on the interior of the image, the pixels whose window
+// lies wholly inside it, and pixel_average() on the border around it: the
+// first and last blur_radius-1 rows, and as many pixels at either end of
+// the rows between. The interior kernel then never checks an index.
+template <unsigned NCHANNELS, typename InteriorAverage>
+void blur_interior_border(unsigned char *out, const unsigned char *in,
+                          const int blur_radius,
+                          const unsigned w, const unsigned h, const unsigned nchannels,
+                          const box_divisor &divide, const blur_border border,
+                          const InteriorAverage &average)
+{
+  int x0, x1, y0, y1;
+  interior_range(blur_radius-1, w, x0, x1);
+  interior_range(blur_radius-1, h, y0, y1);
+
+  for (int y = 0; y < (int)h; ++y) {
+    const bool interior_row = y >= y0 && y < y1;
+    const int xb = interior_row ? x0 : (int)w, xe = interior_row ? x1 : (int)w;
+    for (int x = 0; x < xb; ++x)
+      pixel_average<NCHANNELS>(out,in,x,y,blur_radius,w,h,nchannels,divide,border);
+    for (int x = xb; x < xe; ++x)
+      average(x, y);
+    for (int x = xe; x < (int)w; ++x)
+      pixel_average<NCHANNELS>(out,in,x,y,blur_radius,w,h,nchannels,divide,border);
+  }
+}
+
+template <unsigned NCHANNELS>
+void blur_channels(unsigned char *out, const unsigned char *in,
+                   const int blur_radius,
+                   const unsigned w, const unsigned h, const unsigned nchannels,
+                   const box_divisor &divide, const blur_border border)
+{
+  blur_interior_border<NCHANNELS>(out, in, blur_radius, w, h, nchannels, divide, border,
+    [&](const int x, const int y) {
+      interior_average<NCHANNELS>(out, in, x, y, blur_radius, w, nchannels, divide);
+    });
+}
+
+// The radii from min_fixed_radius to max_fixed_radius, the usual ones for
+// unsharp masking, have kernels of their own for 1, 3 and 4 channels, with
+// the window unrolled in full and the total divided by a constant. blur()
+// and blur_separable() look them up in a table by radius and channel
+// count, and use the kernels above for any other image.
+const int min_fixed_radius = 2, max_fixed_radius = 8;
+
+typedef void (*fixed_blur_kernel)(unsigned char *out, const unsigned char *in,
+                                  unsigned w, unsigned h, blur_rounding rounding,
+                                  blur_border border);
+
+typedef void (*fixed_separable_kernel)(unsigned char *out, const unsigned char *in,
+                                       unsigned w, unsigned h, blur_rounding rounding);
+
+const int fixed_radii = max_fixed_radius-min_fixed_radius+1;
+
+// The kernel of table for blur_radius and nchannels, or nullptr.
+template <typename Kernel>
+Kernel find_fixed_kernel(const Kernel (&table)[fixed_radii][3],
+                         const int blur_radius, const unsigned nchannels)
+{
+  if (blur_radius < min_fixed_radius || blur_radius > max_fixed_radius) return nullptr;
+  const int column = nchannels == 1 ? 0 : nchannels == 3 ? 1 : nchannels == 4 ? 2 : -1;
+  return column < 0 ? nullptr : table[blur_radius-min_fixed_radius][column];
+}
+
+// blur_channels() with the radius fixed at RADIUS. Each row of an interior
+// window is added as straight-line code.
+template <int RADIUS, unsigned NCHANNELS>
+void blur_fixed_channels(unsigned char *out, const unsigned char *in,
+                         const unsigned w, const unsigned h,
+                         const blur_rounding rounding, const blur_border border)
+{
+  const int window = 2*RADIUS-1;
+  const fixed_divisor<box_samples(RADIUS)> divide(rounding);
+
+  blur_interior_border<NCHANNELS>(out, in, RADIUS, w, h, NCHANNELS,
+    box_divisor(box_samples(RADIUS), rounding), border,
+    [&](const int x, const int y) {
+      unsigned totals[NCHANNELS] = {};
+      for (int j = y-RADIUS+1; j < y+RADIUS; ++j) {
+        const unsigned char *first = in + (j*w + x-RADIUS+1)*NCHANNELS;
+        unroll<window>::apply([&](const int i) {
+          add_pixel<NCHANNELS>(totals, first + i*NCHANNELS, NCHANNELS);
+        });
+      }
+      unroll<NCHANNELS>::apply([&](const int c) {
+        out[(y*w+x)*NCHANNELS+c] = divide(totals[c]);
+      });
+    });
+}
+
+const fixed_blur_kernel fixed_blurs[fixed_radii][3] = {
+  { blur_fixed_channels<2,1>, blur_fixed_channels<2,3>, blur_fixed_channels<2,4> },
+  { blur_fixed_channels<3,1>, blur_fixed_channels<3,3>, blur_fixed_channels<3,4> },
+  { blur_fixed_channels<4,1>, blur_fixed_channels<4,3>, blur_fixed_channels<4,4> },
+  { blur_fixed_channels<5,1>, blur_fixed_channels<5,3>, blur_fixed_channels<5,4> },
+  { blur_fixed_channels<6,1>, blur_fixed_channels<6,3>, blur_fixed_channels<6,4> },
+  { blur_fixed_channels<7,1>, blur_fixed_channels<7,3>, blur_fixed_channels<7,4> },
+  { blur_fixed_channels<8,1>, blur_fixed_channels<8,3>, blur_fixed_channels<8,4> }
+};
+
 void blur(unsigned char *out, const unsigned char *in,
           const int blur_radius,
-          const unsigned w, const unsigned h, const unsigned nchannels)
+          const unsigned w, const unsigned h, const unsigned nchannels,
+          const blur_rounding rounding = blur_rounding::truncate,
+          const blur_border border = blur_border::replicate)
+{
+  if (const fixed_blur_kernel kernel = find_fixed_kernel(fixed_blurs, blur_radius, nchannels)) {
+    kernel(out, in, w, h, rounding, border);
+    return;
+  }
+  const box_divisor divide(box_samples(blur_radius), rounding);
+  switch (nchannels) {
+    case 1:  blur_channels<1>(out, in, blur_radius, w, h, nchannels, divide, border); break;
+    case 3:  blur_channels<3>(out, in, blur_radius, w, h, nchannels, divide, border); break;
+    case 4:  blur_channels<4>(out, in, blur_radius, w, h, nchannels, divide, border); break;
+    default: blur_channels<0>(out, in, blur_radius, w, h, nchannels, divide, border); break;
+  }
+}
+
+// A column total of 2*blur_radius-1 bytes fits in 16 bits up to a radius of
+// 129, which covers every radius an unsharp mask is used with. The sliding
+// blurs then keep their column totals in 16-bit lanes, twice as many per
+// vector as 32-bit ones, and use 32-bit lanes for larger radii. Turning
+// narrow_blur_lanes() off forces 32-bit lanes, to compare the two.
+inline bool fits_16_bit_lanes(const int blur_radius)
+{
+  return unsigned(2*blur_radius-1)*UCHAR_MAX <= UINT16_MAX;
+}
+
+inline std::atomic<bool> &narrow_blur_lanes()
+{
+  static std::atomic<bool> enabled(true);
+  return enabled;
+}
+
+inline bool use_16_bit_lanes(const int blur_radius)
+{
+  return narrow_blur_lanes() && fits_16_bit_lanes(blur_radius);
+}
+
+// Adds a row of the image to the running column totals of a window.
+void add_row(unsigned *column_totals, const unsigned char *row,
+             const unsigned row_size)
+{
+  active_row_kernels().add_row(column_totals, row, row_size);
+}
+
+// Moves the window of running column totals down a row: adds the row
+// entering the window and subtracts the row leaving it.
+void slide_rows(unsigned *column_totals,
+                const unsigned char *enter, const unsigned char *leave,
+                const unsigned row_size)
+{
+  active_row_kernels().slide_rows(column_totals, enter, leave, row_size);
+}
+
+// The same on 16-bit column totals; see use_16_bit_lanes().
+void add_row(uint16_t *column_totals, const unsigned char *row,
+             const unsigned row_size)
+{
+  active_row_kernels().add_row16(column_totals, row, row_size);
+}
+
+void slide_rows(uint16_t *column_totals,
+                const unsigned char *enter, const unsigned char *leave,
+                const unsigned row_size)
+{
+  active_row_kernels().slide_rows16(column_totals, enter, leave, row_size);
+}
+
+// Averages the output pixels [x_begin, x_end) of a row from the column
+// totals of their window, where column_totals starts at image column
+// column_begin and covers every column the pixels' windows reach. A total
+// along the row slides over them, writing each pixel's window total into
+// box_totals (scratch for the span), which are then divided in one
+// vectorised pass. Columns outside the image replicate the border column.
+// The column totals are 32-bit or 16-bit.
+template <unsigned NCHANNELS, typename T>
+void average_span_channels(unsigned char *out, const T *column_totals,
+                           const unsigned column_begin,
+                           const int x_begin, const int x_end,
+                           const int reach, const box_divisor &divide,
+                           const unsigned w, const unsigned nchannels,
+                           unsigned *box_totals)
+{
+  const unsigned channels = NCHANNELS ? NCHANNELS : nchannels;
+  for (unsigned c = 0; c < channels; ++c) {
+    unsigned total = 0;
+    for (int i = x_begin-reach; i <= x_begin+reach; ++i)
+      total += column_totals[(clamp_index(i,w)-column_begin)*channels+c];
+
+    for (int x = x_begin; x < x_end; ++x) {
+      box_totals[(x-x_begin)*channels+c] = total;
+      if (x+1 == x_end) break;
+      total += column_totals[(clamp_index(x+reach+1,w)-column_begin)*channels+c]
+             - column_totals[(clamp_index(x-reach,  w)-column_begin)*channels+c];
+    }
+  }
+  active_row_kernels().divide_row(out, box_totals, (x_end-x_begin)*channels,
+                                  divide.multiplier, divide.bias, divide.shift);
+}
+
+template <typename T>
+void average_span(unsigned char *out, const T *column_totals,
+                  const unsigned column_begin,
+                  const int x_begin, const int x_end,
+                  const int reach, const box_divisor &divide,
+                  const unsigned w, const unsigned nchannels,
+                  unsigned *box_totals)
+{
+  switch (nchannels) {
+    case 1:
+      average_span_channels<1>(out, column_totals, column_begin, x_begin, x_end,
+                               reach, divide, w, nchannels, box_totals); break;
+    case 3:
+      average_span_channels<3>(out, column_totals, column_begin, x_begin, x_end,
+                               reach, divide, w, nchannels, box_totals); break;
+    case 4:
+      average_span_channels<4>(out, column_totals, column_begin, x_begin, x_end,
+                               reach, divide, w, nchannels, box_totals); break;
+    default:
+      average_span_channels<0>(out, column_totals, column_begin, x_begin, x_end,
+                               reach, divide, w, nchannels, box_totals); break;
+  }
+}
+
+// average_span() over a whole row.
+template <typename T>
+void average_row(unsigned char *out_row, const T *column_totals,
+                 const int reach, const box_divisor &divide,
+                 const unsigned w, const unsigned nchannels,
+                 unsigned *box_totals)
+{
+  average_span(out_row, column_totals, 0, 0, w, reach, divide, w, nchannels, box_totals);
+}
+
+// Computes the same box average as blur(), but with running sums: a total
+// per column of the 2*blur_radius-1 rows in the window is updated by adding
+// the entering row and subtracting the leaving one, and a total along the
+// row slides over those column totals in the same way. The cost per pixel
+// is then independent of blur_radius, and the output matches blur() byte
+// for byte. Only output rows [y_begin, y_end) are written, so bands of rows
+// can be blurred independently; each band primes its own column totals.
+template <typename T>
+void blur_sliding_rows_lanes(unsigned char *out, const unsigned char *in,
+                             const int blur_radius,
+                             const unsigned w, const unsigned h, const unsigned nchannels,
+                             const unsigned y_begin, const unsigned y_end,
+                             const blur_rounding rounding)
 {
-  for (int y = 0; y < h; ++y) {
-    for (int x = 0; x < w; ++x) {
-      pixel_average(out,in,x,y,blur_radius,w,h,nchannels);
+  const int reach = blur_radius-1;
+  const box_divisor divide(box_samples(blur_radius), rounding);
+  const unsigned row_size = w*nchannels;
+  std::vector<T> column_totals(row_size, 0);
+  std::vector<unsigned> box_totals(row_size);
+
+  for (int j = (int)y_begin-reach; j <= (int)y_begin+reach; ++j)
+    add_row(column_totals.data(), in + clamp_index(j,h)*row_size, row_size);
+
+  for (int y = y_begin; y < (int)y_end; ++y) {
+    if (y > (int)y_begin)
+      slide_rows(column_totals.data(),
+                 in + clamp_index(y+reach,  h)*row_size,
+                 in + clamp_index(y-reach-1,h)*row_size, row_size);
+
+    average_row(out + y*row_size, column_totals.data(),
+                reach, divide, w, nchannels, box_totals.data());
+  }
+}
+
+void blur_sliding_rows(unsigned char *out, const unsigned char *in,
+                       const int blur_radius,
+                       const unsigned w, const unsigned h, const unsigned nchannels,
+                       const unsigned y_begin, const unsigned y_end,
+                       const blur_rounding rounding = blur_rounding::truncate)
+{
+  assert(blur_radius >= 1);
+  if (use_16_bit_lanes(blur_radius))
+    blur_sliding_rows_lanes<uint16_t>(out, in, blur_radius, w, h, nchannels, y_begin, y_end, rounding);
+  else
+    blur_sliding_rows_lanes<unsigned>(out, in, blur_radius, w, h, nchannels, y_begin, y_end, rounding);
+}
+
+void blur_sliding(unsigned char *out, const unsigned char *in,
+                  const int blur_radius,
+                  const unsigned w, const unsigned h, const unsigned nchannels,
+                  const blur_rounding rounding = blur_rounding::truncate)
+{
+  blur_sliding_rows(out, in, blur_radius, w, h, nchannels, 0, h, rounding);
+}
+
+// A rectangle [x0,x1) x [y0,y1) of the image held in a buffer, with image
+// pixel (x,y) at data + (y-y0)*stride + (x-x0)*nchannels. The whole image is
+// the region { in, 0, 0, w, h, w*nchannels, nchannels }.
+struct image_region {
+  unsigned char *data;
+  unsigned x0, y0, x1, y1;
+  unsigned stride, nchannels;
+
+  unsigned width()  const { return x1-x0; }
+  unsigned height() const { return y1-y0; }
+  unsigned size()   const { return height()*stride; }
+
+  unsigned char *pixel(const unsigned x, const unsigned y) const
+  {
+    return data + (y-y0)*stride + (x-x0)*nchannels;
+  }
+};
+
+// The region grown by reach pixels on every side and cut to the image,
+// laid out as a tightly packed buffer whose data is still to be set.
+inline image_region grow_region(const image_region &r, const int reach,
+                                const unsigned w, const unsigned h)
+{
+  image_region grown = r;
+  grown.data = nullptr;
+  grown.x0 = clamp_index((int)r.x0-reach, w); grown.x1 = clamp_index((int)r.x1-1+reach, w)+1;
+  grown.y0 = clamp_index((int)r.y0-reach, h); grown.y1 = clamp_index((int)r.y1-1+reach, h)+1;
+  grown.stride = grown.width()*r.nchannels;
+  return grown;
+}
+
+template <typename T>
+void blur_region_lanes(const image_region &out, const image_region &in,
+                       const int blur_radius, const unsigned w, const unsigned h,
+                       T *column_totals, unsigned *box_totals,
+                       const blur_rounding rounding)
+{
+  const unsigned nchannels = out.nchannels;
+  const int reach = blur_radius-1;
+  const box_divisor divide(box_samples(blur_radius), rounding);
+  const unsigned x0 = clamp_index((int)out.x0-reach, w);
+  const unsigned span = (clamp_index((int)out.x1-1+reach, w)+1 - x0)*nchannels;
+  assert(x0 >= in.x0 && x0*nchannels+span <= in.x1*nchannels);
+
+  for (unsigned i = 0; i < span; ++i) column_totals[i] = 0;
+  for (int j = (int)out.y0-reach; j <= (int)out.y0+reach; ++j)
+    add_row(column_totals, in.pixel(x0, clamp_index(j,h)), span);
+
+  for (int y = out.y0; y < (int)out.y1; ++y) {
+    if (y > (int)out.y0)
+      slide_rows(column_totals,
+                 in.pixel(x0, clamp_index(y+reach,  h)),
+                 in.pixel(x0, clamp_index(y-reach-1,h)), span);
+
+    average_span(out.pixel(out.x0, y), column_totals, x0, out.x0, out.x1,
+                 reach, divide, w, nchannels, box_totals);
+  }
+}
+
+// blur_sliding() of a region of the image: writes the blurred pixels of out
+// from in, which must hold grow_region(out, blur_radius-1). Windows are
+// still clamped to the image border, not the region, so a tile of the image
+// is blurred exactly as it is in the whole frame. column_totals and
+// box_totals are scratch of in's width in bytes; 16-bit column totals use
+// the first half of theirs.
+void blur_region(const image_region &out, const image_region &in,
+                 const int blur_radius, const unsigned w, const unsigned h,
+                 unsigned *column_totals, unsigned *box_totals,
+                 const blur_rounding rounding = blur_rounding::truncate)
+{
+  assert(blur_radius >= 1 && in.nchannels == out.nchannels);
+  if (use_16_bit_lanes(blur_radius))
+    blur_region_lanes(out, in, blur_radius, w, h, reinterpret_cast<uint16_t *>(column_totals),
+                      box_totals, rounding);
+  else
+    blur_region_lanes(out, in, blur_radius, w, h, column_totals, box_totals, rounding);
+}
+
+// Computes the same box average as blur() in two one-dimensional passes:
+// the horizontal pass writes the 2*blur_radius-1 wide row totals of each
+// pixel into an intermediate buffer, and the vertical pass sums those totals
+// down each column. The square window is separable, so each pixel costs
+// O(blur_radius) samples rather than O(blur_radius^2), with the same
+// border replication and byte-for-byte output as blur_sliding().
+template <unsigned NCHANNELS>
+void blur_separable_channels(unsigned char *out, const unsigned char *in,
+                             const int blur_radius,
+                             const unsigned w, const unsigned h, const unsigned nchannels,
+                             const box_divisor &divide)
+{
+  const unsigned channels = NCHANNELS ? NCHANNELS : nchannels;
+  std::vector<unsigned, image_allocator<unsigned>> row_totals(w*h*channels);
+
+  for (int y = 0; y < (int)h; ++y) {
+    for (int x = 0; x < (int)w; ++x) {
+      for (unsigned c = 0; c < channels; ++c) {
+        unsigned total = 0;
+        for (int i = x-blur_radius+1; i < x+blur_radius; ++i)
+          total += in[(y*w+clamp_index(i,w))*channels+c];
+        row_totals[(y*w+x)*channels+c] = total;
+      }
+    }
+  }
+
+  for (int y = 0; y < (int)h; ++y) {
+    for (int x = 0; x < (int)w; ++x) {
+      for (unsigned c = 0; c < channels; ++c) {
+        unsigned total = 0;
+        for (int j = y-blur_radius+1; j < y+blur_radius; ++j)
+          total += row_totals[(clamp_index(j,h)*w+x)*channels+c];
+        out[(y*w+x)*channels+c] = divide(total);
+      }
+    }
+  }
+}
+
+// blur_separable_channels() with the radius fixed at RADIUS, its windows
+// unrolled as in blur_fixed_channels().
+template <int RADIUS, unsigned NCHANNELS>
+void blur_separable_fixed_channels(unsigned char *out, const unsigned char *in,
+                                   const unsigned w, const unsigned h,
+                                   const blur_rounding rounding)
+{
+  const int window = 2*RADIUS-1;
+  const fixed_divisor<box_samples(RADIUS)> divide(rounding);
+  std::vector<unsigned, image_allocator<unsigned>> row_totals(w*h*NCHANNELS);
+
+  for (int y = 0; y < (int)h; ++y) {
+    const unsigned char *row = in + y*w*NCHANNELS;
+    for (int x = 0; x < (int)w; ++x) {
+      unsigned totals[NCHANNELS] = {};
+      if (x >= RADIUS-1 && x+RADIUS <= (int)w) {
+        const unsigned char *first = row + (x-RADIUS+1)*NCHANNELS;
+        unroll<window>::apply([&](const int i) {
+          add_pixel<NCHANNELS>(totals, first + i*NCHANNELS, NCHANNELS);
+        });
+      }
+      else {
+        unroll<window>::apply([&](const int i) {
+          add_pixel<NCHANNELS>(totals, row + clamp_index(x-RADIUS+1+i, w)*NCHANNELS, NCHANNELS);
+        });
+      }
+      unroll<NCHANNELS>::apply([&](const int c) {
+        row_totals[(y*w+x)*NCHANNELS+c] = totals[c];
+      });
     }
   }
+
+  for (int y = 0; y < (int)h; ++y) {
+    const unsigned *rows[window];
+    unroll<window>::apply([&](const int j) {
+      rows[j] = row_totals.data() + clamp_index(y-RADIUS+1+j, h)*w*NCHANNELS;
+    });
+    for (unsigned i = 0; i < w*NCHANNELS; ++i) {
+      unsigned total = 0;
+      unroll<window>::apply([&](const int j) { total += rows[j][i]; });
+      out[y*w*NCHANNELS+i] = divide(total);
+    }
+  }
+}
+
+const fixed_separable_kernel fixed_separable_blurs[fixed_radii][3] = {
+  { blur_separable_fixed_channels<2,1>, blur_separable_fixed_channels<2,3>, blur_separable_fixed_channels<2,4> },
+  { blur_separable_fixed_channels<3,1>, blur_separable_fixed_channels<3,3>, blur_separable_fixed_channels<3,4> },
+  { blur_separable_fixed_channels<4,1>, blur_separable_fixed_channels<4,3>, blur_separable_fixed_channels<4,4> },
+  { blur_separable_fixed_channels<5,1>, blur_separable_fixed_channels<5,3>, blur_separable_fixed_channels<5,4> },
+  { blur_separable_fixed_channels<6,1>, blur_separable_fixed_channels<6,3>, blur_separable_fixed_channels<6,4> },
+  { blur_separable_fixed_channels<7,1>, blur_separable_fixed_channels<7,3>, blur_separable_fixed_channels<7,4> },
+  { blur_separable_fixed_channels<8,1>, blur_separable_fixed_channels<8,3>, blur_separable_fixed_channels<8,4> }
+};
+
+void blur_separable(unsigned char *out, const unsigned char *in,
+                    const int blur_radius,
+                    const unsigned w, const unsigned h, const unsigned nchannels,
+                    const blur_rounding rounding = blur_rounding::truncate)
+{
+  assert(blur_radius >= 1);
+  if (const fixed_separable_kernel kernel = find_fixed_kernel(fixed_separable_blurs, blur_radius, nchannels)) {
+    kernel(out, in, w, h, rounding);
+    return;
+  }
+  const box_divisor divide(box_samples(blur_radius), rounding);
+  switch (nchannels) {
+    case 1:  blur_separable_channels<1>(out, in, blur_radius, w, h, nchannels, divide); break;
+    case 3:  blur_separable_channels<3>(out, in, blur_radius, w, h, nchannels, divide); break;
+    case 4:  blur_separable_channels<4>(out, in, blur_radius, w, h, nchannels, divide); break;
+    default: blur_separable_channels<0>(out, in, blur_radius, w, h, nchannels, divide); break;
+  }
+}
+
+// Writes the totals of the 2*reach+1 wide windows centred on each of the n
+// pixels of a row, sliding along it; pixels past either end replicate the
+// end pixel. in is a row of bytes or of 32-bit totals.
+template <unsigned NCHANNELS, typename T>
+void box_row_totals(unsigned *out, const T *in, const int reach,
+                    const unsigned n, const unsigned nchannels)
+{
+  const unsigned channels = NCHANNELS ? NCHANNELS : nchannels;
+  for (unsigned c = 0; c < channels; ++c) {
+    unsigned total = 0;
+    for (int i = -reach; i <= reach; ++i)
+      total += in[clamp_index(i,n)*channels+c];
+
+    for (int x = 0; x < (int)n; ++x) {
+      out[x*channels+c] = total;
+      total += in[clamp_index(x+reach+1,n)*channels+c]
+             - in[clamp_index(x-reach,  n)*channels+c];
+    }
+  }
+}
+
+// Computes the same box average as blur() as two horizontal passes, each
+// followed by a transpose: the row totals are transposed so that the
+// vertical window also slides along rows, and the averages transposed back.
+// Neither pass walks memory a column at a time; the transposes are
+// cache-blocked instead. The output matches blur_sliding() byte for byte.
+template <unsigned NCHANNELS>
+void blur_transposed_channels(unsigned char *out, const unsigned char *in,
+                              const int blur_radius,
+                              const unsigned w, const unsigned h, const unsigned nchannels,
+                              const box_divisor &divide)
+{
+  const unsigned channels = NCHANNELS ? NCHANNELS : nchannels;
+  const int reach = blur_radius-1;
+  const std::size_t row_size = w*channels, column_size = h*channels;
+  std::vector<unsigned, image_allocator<unsigned>> totals(w*h*channels), transposed(w*h*channels);
+  std::vector<unsigned> column_totals(column_size);
+  image_buffer averages(w*h*channels);
+
+  for (unsigned y = 0; y < h; ++y)
+    box_row_totals<NCHANNELS>(&totals[y*row_size], in + y*row_size, reach, w, channels);
+  transpose(transposed.data(), column_size*sizeof(unsigned),
+            totals.data(), row_size*sizeof(unsigned), h, w, channels*sizeof(unsigned));
+
+  for (unsigned x = 0; x < w; ++x) {
+    box_row_totals<NCHANNELS>(column_totals.data(), &transposed[x*column_size], reach, h, channels);
+    active_row_kernels().divide_row(&averages[x*column_size], column_totals.data(), column_size,
+                                    divide.multiplier, divide.bias, divide.shift);
+  }
+  transpose(out, row_size, averages.data(), column_size, w, h, channels);
+}
+
+void blur_transposed(unsigned char *out, const unsigned char *in,
+                     const int blur_radius,
+                     const unsigned w, const unsigned h, const unsigned nchannels,
+                     const blur_rounding rounding = blur_rounding::truncate)
+{
+  assert(blur_radius >= 1);
+  const box_divisor divide(box_samples(blur_radius), rounding);
+  switch (nchannels) {
+    case 1:  blur_transposed_channels<1>(out, in, blur_radius, w, h, nchannels, divide); break;
+    case 3:  blur_transposed_channels<3>(out, in, blur_radius, w, h, nchannels, divide); break;
+    case 4:  blur_transposed_channels<4>(out, in, blur_radius, w, h, nchannels, divide); break;
+    default: blur_transposed_channels<0>(out, in, blur_radius, w, h, nchannels, divide); break;
+  }
+}
+
+// The baseline blur_transposed() is measured against: the same sliding row
+// pass, then the vertical window slid straight down each column of the row
+// totals, a stride of a whole row per step, with no transpose. The output
+// matches blur_sliding() byte for byte.
+template <unsigned NCHANNELS>
+void blur_strided_channels(unsigned char *out, const unsigned char *in,
+                           const int blur_radius,
+                           const unsigned w, const unsigned h, const unsigned nchannels,
+                           const box_divisor &divide)
+{
+  const unsigned channels = NCHANNELS ? NCHANNELS : nchannels;
+  const int reach = blur_radius-1;
+  const std::size_t row_size = w*channels, column_size = h*channels;
+  std::vector<unsigned, image_allocator<unsigned>> totals(w*h*channels);
+  std::vector<unsigned> column_totals(column_size);
+  std::vector<unsigned char> averages(column_size);
+
+  for (unsigned y = 0; y < h; ++y)
+    box_row_totals<NCHANNELS>(&totals[y*row_size], in + y*row_size, reach, w, channels);
+
+  for (unsigned x = 0; x < w; ++x) {
+    const unsigned *column = &totals[x*channels];
+    for (unsigned c = 0; c < channels; ++c) {
+      unsigned total = 0;
+      for (int j = -reach; j <= reach; ++j)
+        total += column[clamp_index(j,h)*row_size+c];
+
+      for (int y = 0; y < (int)h; ++y) {
+        column_totals[y*channels+c] = total;
+        total += column[clamp_index(y+reach+1,h)*row_size+c]
+               - column[clamp_index(y-reach,  h)*row_size+c];
+      }
+    }
+    active_row_kernels().divide_row(averages.data(), column_totals.data(), column_size,
+                                    divide.multiplier, divide.bias, divide.shift);
+    for (unsigned y = 0; y < h; ++y)
+      for (unsigned c = 0; c < channels; ++c)
+        out[y*row_size+x*channels+c] = averages[y*channels+c];
+  }
+}
+
+void blur_strided(unsigned char *out, const unsigned char *in,
+                  const int blur_radius,
+                  const unsigned w, const unsigned h, const unsigned nchannels,
+                  const blur_rounding rounding = blur_rounding::truncate)
+{
+  assert(blur_radius >= 1);
+  const box_divisor divide(box_samples(blur_radius), rounding);
+  switch (nchannels) {
+    case 1:  blur_strided_channels<1>(out, in, blur_radius, w, h, nchannels, divide); break;
+    case 3:  blur_strided_channels<3>(out, in, blur_radius, w, h, nchannels, divide); break;
+    case 4:  blur_strided_channels<4>(out, in, blur_radius, w, h, nchannels, divide); break;
+    default: blur_strided_channels<0>(out, in, blur_radius, w, h, nchannels, divide); break;
+  }
+}
+
+// A summed-area table per channel: entry (x,y) of channel c holds the total
+// of the channel over all pixels above and to the left of (x,y), so the
+// table is (w+1)*(h+1) entries with a zero first row and column. Entries are
+// 32-bit and may wrap on large images, but any box total that fits in 32
+// bits is still recovered exactly by modular subtraction.
+struct integral_image {
+  void build(const unsigned char *in,
+             const unsigned w, const unsigned h, const unsigned nchannels)
+  {
+    this->w = w; this->h = h; this->nchannels = nchannels;
+    totals.assign((w+1)*(h+1)*nchannels, 0);
+
+    for (unsigned c = 0; c < nchannels; ++c) {
+      unsigned *table = &totals[c*(w+1)*(h+1)];
+      for (unsigned y = 0; y < h; ++y) {
+        unsigned row_total = 0;
+        for (unsigned x = 0; x < w; ++x) {
+          row_total += in[(y*w+x)*nchannels+c];
+          table[(y+1)*(w+1)+x+1] = table[y*(w+1)+x+1] + row_total;
+        }
+      }
+    }
+  }
+
+  // Total of channel c over the pixels in [x0,x1) x [y0,y1).
+  unsigned rect_total(const unsigned c,
+                      const unsigned x0, const unsigned y0,
+                      const unsigned x1, const unsigned y1) const
+  {
+    const unsigned *table = &totals[c*(w+1)*(h+1)];
+    return table[y1*(w+1)+x1] - table[y0*(w+1)+x1]
+         - table[y1*(w+1)+x0] + table[y0*(w+1)+x0];
+  }
+
+  // Total of channel c over the square of pixels within reach of (x,y),
+  // replicating the border for the parts outside the image. Inside the
+  // image that is a single rect_total(); near an edge the replicated edge
+  // row, column and corner are added in with their repeat counts.
+  unsigned box_total(const unsigned c, const int x, const int y,
+                     const int reach) const
+  {
+    struct span { unsigned begin, end, weight; };
+    const int x0 = x-reach, x1 = x+reach, y0 = y-reach, y1 = y+reach;
+    const span xs[3] = {
+      { 0,   1,                                  x0 < 0 ? (unsigned)-x0 : 0 },
+      { clamp_index(x0,w), clamp_index(x1,w)+1, 1 },
+      { w-1, w, x1 >= (int)w ? (unsigned)(x1-(int)w+1) : 0 } };
+    const span ys[3] = {
+      { 0,   1,                                  y0 < 0 ? (unsigned)-y0 : 0 },
+      { clamp_index(y0,h), clamp_index(y1,h)+1, 1 },
+      { h-1, h, y1 >= (int)h ? (unsigned)(y1-(int)h+1) : 0 } };
+
+    unsigned total = 0;
+    for (const span &sy : ys) {
+      if (sy.weight == 0) continue;
+      for (const span &sx : xs) {
+        if (sx.weight == 0) continue;
+        total += sx.weight * sy.weight
+               * rect_total(c, sx.begin, sy.begin, sx.end, sy.end);
+      }
+    }
+    return total;
+  }
+
+  std::vector<unsigned, image_allocator<unsigned>> totals;
+  unsigned w, h, nchannels;
+};
+
+// Computes the same box average as blur() from a summed-area table: after
+// building the table once, every pixel costs four lookups per channel
+// whatever the blur_radius (a few more along the border). The output
+// matches blur_sliding() byte for byte. Since box_total() takes the reach
+// per call, the table also supports a radius that varies across the image.
+template <unsigned NCHANNELS>
+void blur_integral_channels(unsigned char *out, const unsigned char *in,
+                            const int blur_radius,
+                            const unsigned w, const unsigned h, const unsigned nchannels,
+                            const box_divisor &divide)
+{
+  const unsigned channels = NCHANNELS ? NCHANNELS : nchannels;
+  integral_image table;
+  table.build(in, w, h, channels);
+
+  for (int y = 0; y < (int)h; ++y) {
+    for (int x = 0; x < (int)w; ++x) {
+      for (unsigned c = 0; c < channels; ++c) {
+        out[(y*w+x)*channels+c] = divide(table.box_total(c, x, y, blur_radius-1));
+      }
+    }
+  }
+}
+
+void blur_integral(unsigned char *out, const unsigned char *in,
+                   const int blur_radius,
+                   const unsigned w, const unsigned h, const unsigned nchannels,
+                   const blur_rounding rounding = blur_rounding::truncate)
+{
+  assert(blur_radius >= 1);
+  const box_divisor divide(box_samples(blur_radius), rounding);
+  switch (nchannels) {
+    case 1:  blur_integral_channels<1>(out, in, blur_radius, w, h, nchannels, divide); break;
+    case 3:  blur_integral_channels<3>(out, in, blur_radius, w, h, nchannels, divide); break;
+    case 4:  blur_integral_channels<4>(out, in, blur_radius, w, h, nchannels, divide); break;
+    default: blur_integral_channels<0>(out, in, blur_radius, w, h, nchannels, divide); break;
+  }
+}
+
+// The interchangeable implementations of the box blur.
+enum class blur_method { naive, sliding, separable, integral, transposed, strided };
+
+void blur(unsigned char *out, const unsigned char *in,
+          const int blur_radius,
+          const unsigned w, const unsigned h, const unsigned nchannels,
+          const blur_method method,
+          const blur_rounding rounding = blur_rounding::truncate,
+          const blur_border border = blur_border::replicate)
+{
+  // Only the naive blur implements the other border modes.
+  assert(method == blur_method::naive || border == blur_border::replicate);
+  switch (method) {
+    case blur_method::naive:
+      blur(out, in, blur_radius, w, h, nchannels, rounding, border); break;
+    case blur_method::sliding:
+      blur_sliding(out, in, blur_radius, w, h, nchannels, rounding); break;
+    case blur_method::separable:
+      blur_separable(out, in, blur_radius, w, h, nchannels, rounding); break;
+    case blur_method::integral:
+      blur_integral(out, in, blur_radius, w, h, nchannels, rounding); break;
+    case blur_method::transposed:
+      blur_transposed(out, in, blur_radius, w, h, nchannels, rounding); break;
+    case blur_method::strided:
+      blur_strided(out, in, blur_radius, w, h, nchannels, rounding); break;
+  }
 }
 
 #endif // _BLUR_HPP_
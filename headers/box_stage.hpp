@@ -0,0 +1,119 @@
+#ifndef _BOX_STAGE_HPP_
+#define _BOX_STAGE_HPP_
+
+#include <vector>
+#include <cstring>
+#include <cassert>
+#include "blur.hpp"
+
+// One box blur of a streaming cascade. Input rows are pushed in order from
+// the top of the image, and output row y can be popped as soon as the rows
+// its window reaches below it have arrived. Only the last 2*blur_radius
+// input rows are kept, in a ring, alongside the running column totals of
+// blur_sliding(), so memory is O(w * blur_radius) regardless of h. The
+// output is byte for byte that of blur(). The column totals are 16-bit when
+// use_16_bit_lanes() allows it.
+//
+// Pop every ready row before pushing the next: pushing overwrites the
+// oldest row of the ring, which the next pop may still need otherwise.
+class box_stage {
+public:
+  box_stage(const int blur_radius,
+            const unsigned w, const unsigned h, const unsigned nchannels,
+            const blur_rounding rounding = blur_rounding::truncate)
+    : reach(blur_radius-1),
+      divide(box_samples(blur_radius), rounding),
+      w(w), h(h), nchannels(nchannels), row_size(w*nchannels),
+      ring_rows(2*blur_radius < (int)h ? 2*blur_radius : h),
+      rows_in(0), rows_out(0), narrow(use_16_bit_lanes(blur_radius)),
+      ring(ring_rows*row_size),
+      column_totals(narrow ? 0 : row_size, 0), narrow_totals(narrow ? row_size : 0, 0),
+      box_totals(row_size)
+  {
+    assert(blur_radius >= 1);
+  }
+
+  // Copies the next input row into the ring.
+  void push(const unsigned char *row)
+  {
+    assert(rows_in < h && !ready());
+    std::memcpy(ring_row(rows_in), row, row_size);
+    ++rows_in;
+  }
+
+  // Whether the next output row has all the input rows its window needs.
+  bool ready() const
+  {
+    if (rows_out >= h) return false;
+    const unsigned last = clamp_index(rows_out+reach, h);
+    return rows_in > last;
+  }
+
+  // Writes the next output row and slides the window down.
+  void pop(unsigned char *out_row)
+  {
+    assert(ready());
+    if (narrow) pop_with(narrow_totals.data(), out_row);
+    else        pop_with(column_totals.data(), out_row);
+    ++rows_out;
+  }
+
+  unsigned rows_pushed() const { return rows_in; }
+  unsigned rows_popped() const { return rows_out; }
+
+  // The memory held by the stage, which does not depend on h.
+  std::size_t bytes_used() const
+  {
+    return ring.size() + (column_totals.size() + box_totals.size()) * sizeof(unsigned)
+         + narrow_totals.size() * sizeof(uint16_t);
+  }
+
+private:
+  template <typename T>
+  void pop_with(T *totals, unsigned char *out_row)
+  {
+    const int y = rows_out;
+    if (y == 0) {
+      for (int j = -reach; j <= reach; ++j)
+        add_row(totals, ring_row(clamp_index(j,h)), row_size);
+    }
+    else {
+      slide_rows(totals,
+                 ring_row(clamp_index(y+reach,  h)),
+                 ring_row(clamp_index(y-reach-1,h)), row_size);
+    }
+    average_row(out_row, totals, reach, divide, w, nchannels, box_totals.data());
+  }
+
+  unsigned char *ring_row(const unsigned y) { return &ring[(y%ring_rows)*row_size]; }
+
+  const int reach;
+  const box_divisor divide;
+  const unsigned w, h, nchannels, row_size, ring_rows;
+  unsigned rows_in, rows_out;
+  const bool narrow;
+  std::vector<unsigned char> ring;
+  std::vector<unsigned> column_totals;
+  std::vector<uint16_t> narrow_totals;
+  std::vector<unsigned> box_totals;
+};
+
+// Blurs the image in data in place, as blur() would into another frame.
+// Rows are streamed through a box_stage, which keeps its own copy of the
+// input rows a window still needs, and output row y is only written once
+// input row y has been pushed, so the blur needs O(w * blur_radius) memory
+// instead of a second frame.
+void blur_in_place(unsigned char *data, const int blur_radius,
+                   const unsigned w, const unsigned h, const unsigned nchannels,
+                   const blur_rounding rounding = blur_rounding::truncate)
+{
+  const unsigned row_size = w * nchannels;
+  box_stage stage(blur_radius, w, h, nchannels, rounding);
+  for (unsigned y = 0; y < h; ++y) {
+    stage.push(data + y*row_size);
+    while (stage.ready())
+      stage.pop(data + stage.rows_popped()*row_size);
+  }
+}
+
+#endif // _BOX_STAGE_HPP_
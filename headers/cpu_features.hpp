@@ -0,0 +1,122 @@
+#ifndef _CPU_FEATURES_HPP_
+#define _CPU_FEATURES_HPP_
+
+// Runtime detection of the x86 vector extensions the row kernels use, so a
+// single binary picks the widest tier the host supports, and of the cache
+// sizes the tiled engine sizes its tiles for.
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define UNSHARP_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+// The vector instruction set tiers, in increasing order of width.
+enum class simd_tier { scalar, sse41, avx2 };
+
+inline const char *simd_tier_name(const simd_tier tier)
+{
+  switch (tier) {
+    case simd_tier::sse41: return "sse4.1";
+    case simd_tier::avx2:  return "avx2";
+    default:               return "scalar";
+  }
+}
+
+#if defined(UNSHARP_X86)
+inline void cpuid(unsigned info[4], const unsigned leaf, const unsigned subleaf)
+{
+#if defined(_MSC_VER)
+  int regs[4];
+  __cpuidex(regs, leaf, subleaf);
+  for (int i = 0; i < 4; ++i) info[i] = regs[i];
+#else
+  __cpuid_count(leaf, subleaf, info[0], info[1], info[2], info[3]);
+#endif
+}
+
+// The OS-enabled register state, XCR0.
+inline unsigned long long xgetbv0()
+{
+#if defined(_MSC_VER)
+  return _xgetbv(0);
+#else
+  unsigned eax, edx;
+  __asm__ volatile ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+#endif
+
+// Reads CPUID for the widest tier the processor and OS both support: AVX2
+// also needs the OS to save the YMM registers (OSXSAVE and XCR0).
+inline simd_tier detect_simd_tier()
+{
+#if defined(UNSHARP_X86)
+  unsigned info[4];
+  cpuid(info, 0, 0);
+  const unsigned max_leaf = info[0];
+  if (max_leaf < 1) return simd_tier::scalar;
+
+  cpuid(info, 1, 0);
+  const bool sse41   = (info[2] >> 19) & 1;
+  const bool osxsave = (info[2] >> 27) & 1;
+  const bool avx     = (info[2] >> 28) & 1;
+
+  if (osxsave && avx && max_leaf >= 7 && (xgetbv0() & 0x6) == 0x6) {
+    cpuid(info, 7, 0);
+    if ((info[1] >> 5) & 1) return simd_tier::avx2;
+  }
+  if (sse41) return simd_tier::sse41;
+#endif
+  return simd_tier::scalar;
+}
+
+// The data cache sizes of one core, in bytes; 0 where unknown.
+struct cache_sizes {
+  unsigned long l1d, l2, l3;
+};
+
+// Reads the cache sizes from CPUID: the deterministic cache parameters of
+// leaf 4 where the processor has them (Intel), otherwise the extended
+// leaves 0x80000005/6 (AMD). Falls back to 32K/256K/0 elsewhere.
+inline cache_sizes detect_cache_sizes()
+{
+  cache_sizes sizes = { 0, 0, 0 };
+#if defined(UNSHARP_X86)
+  unsigned info[4];
+  cpuid(info, 0, 0);
+  const unsigned max_leaf = info[0];
+  for (unsigned index = 0; max_leaf >= 4 && index < 16; ++index) {
+    cpuid(info, 4, index);
+    const unsigned type = info[0] & 0x1f;
+    if (type == 0) break;
+    if (type == 2) continue; // instruction cache
+    const unsigned level = (info[0] >> 5) & 0x7;
+    const unsigned long size = ((info[1] >> 22) + 1ul) * (((info[1] >> 12) & 0x3ff) + 1)
+                             * ((info[1] & 0xfff) + 1) * (info[2] + 1ul);
+    if (level == 1) sizes.l1d = size;
+    if (level == 2) sizes.l2  = size;
+    if (level == 3) sizes.l3  = size;
+  }
+  cpuid(info, 0x80000000, 0);
+  const unsigned max_extended = info[0];
+  if (sizes.l1d == 0 && max_extended >= 0x80000005) {
+    cpuid(info, 0x80000005, 0);
+    sizes.l1d = (info[2] >> 24) * 1024ul;
+  }
+  if (sizes.l2 == 0 && max_extended >= 0x80000006) {
+    cpuid(info, 0x80000006, 0);
+    sizes.l2 = (info[2] >> 16) * 1024ul;
+    sizes.l3 = (info[3] >> 18) * 512ul * 1024ul;
+  }
+#endif
+  if (sizes.l1d == 0) sizes.l1d = 32*1024;
+  if (sizes.l2  == 0) sizes.l2  = 256*1024;
+  return sizes;
+}
+
+#endif // _CPU_FEATURES_HPP_
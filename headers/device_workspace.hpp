@@ -0,0 +1,77 @@
+#ifndef _DEVICE_WORKSPACE_HPP_
+#define _DEVICE_WORKSPACE_HPP_
+
+#include <cstddef>
+#include <cassert>
+#include "CL/cl.hpp"
+
+// The scratch buffers the OpenCL run blurs into, owned across runs on one
+// context so that sharpening a batch of images allocates them once rather
+// than per image, as unsharp_workspace does for the host. A buffer only
+// grows, and then to the power-of-two size class of the request, so images
+// of similar sizes share buffers and a batch of growing images reallocates
+// a few times at most. Buffers are created without host data: every kernel
+// writes all of a scratch buffer it later reads, so nothing is copied in.
+class device_workspace {
+public:
+  // The buffers of the run, by index.
+  static const unsigned blurred1 = 0, blurred2 = 1; // ping-pong blur passes
+  static const unsigned row_totals = 2;             // separable and sliding blurs
+  static const unsigned integral = 3;               // summed-area tables
+  static const unsigned layout_image = 4;           // planar or RGBX original
+  static const unsigned max_buffers = 5;
+
+  static const std::size_t min_size = 4096;
+
+  explicit device_workspace(const cl::Context &context)
+    : context(context), allocated(0), allocations(0)
+  {
+    for (std::size_t &size : sizes) size = 0;
+  }
+
+  device_workspace(const device_workspace &) = delete;
+  device_workspace &operator=(const device_workspace &) = delete;
+
+  // The smallest power of two, no less than min_size, that holds bytes.
+  static std::size_t size_class(const std::size_t bytes)
+  {
+    std::size_t size = min_size;
+    while (size < bytes) size *= 2;
+    return size;
+  }
+
+  // Buffer i, at least bytes long. It is only created afresh when it is
+  // smaller than that, and its contents are then lost.
+  cl::Buffer &buffer(const unsigned i, const std::size_t bytes)
+  {
+    assert(i < max_buffers);
+    if (bytes > sizes[i]) {
+      buffers[i] = cl::Buffer(); // release the old buffer before the new one
+      sizes[i] = size_class(bytes);
+      buffers[i] = cl::Buffer(context, CL_MEM_READ_WRITE, sizes[i]);
+      allocated += sizes[i];
+      ++allocations;
+    }
+    return buffers[i];
+  }
+
+  // The bytes held now, and the bytes and buffers allocated over the
+  // workspace's life; they differ once a larger image has made one grow.
+  std::size_t bytes_held() const
+  {
+    std::size_t total = 0;
+    for (const std::size_t size : sizes) total += size;
+    return total;
+  }
+  std::size_t bytes_allocated() const { return allocated; }
+  unsigned buffers_allocated() const { return allocations; }
+
+private:
+  cl::Context context;
+  cl::Buffer buffers[max_buffers];
+  std::size_t sizes[max_buffers];
+  std::size_t allocated;
+  unsigned allocations;
+};
+
+#endif // _DEVICE_WORKSPACE_HPP_
@@ -0,0 +1,203 @@
+#ifndef _IMAGE_BUFFER_HPP_
+#define _IMAGE_BUFFER_HPP_
+
+#include <vector>
+#include <atomic>
+#include <new>
+#include <utility>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <malloc.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#include <fstream>
+#include <string>
+#endif
+
+// Storage for image frames and other large scratch buffers. Every buffer is
+// aligned to a cache line, which also covers the widest row kernel vector.
+// A buffer of at least huge_page_size bytes is mapped on pages of its own,
+// on explicit huge pages when the system has them reserved, and otherwise
+// aligned to huge_page_size and marked for transparent huge pages. A blur
+// pass down the columns of a frame then touches one TLB entry per 2MB
+// instead of one per 4KB. When neither is available such a buffer falls
+// back to ordinary pages.
+const std::size_t image_alignment = 64;
+const std::size_t huge_page_size  = 2 << 20;
+
+// Counts of the buffers allocated so far: all of them, those large enough
+// to be put on huge pages, those that were put on explicit huge pages, and
+// those that asked for transparent huge pages instead. Whether the kernel
+// then backs the latter with huge pages is up to it, so they are counted
+// apart from the buffers known to be on them.
+struct image_memory_counters {
+  std::atomic<unsigned long> buffers, large_buffers, huge_page_buffers, transparent_buffers;
+};
+
+inline image_memory_counters &image_memory_stats()
+{
+  static image_memory_counters counters{ {0}, {0}, {0}, {0} };
+  return counters;
+}
+
+// Whether large buffers ask for huge pages; with this off they still get
+// pages of their own, so buffers allocated either way are freed alike.
+inline std::atomic<bool> &image_huge_pages()
+{
+  static std::atomic<bool> enabled(true);
+  return enabled;
+}
+
+inline std::size_t round_up(const std::size_t bytes, const std::size_t multiple)
+{
+  return (bytes + multiple - 1) / multiple * multiple;
+}
+
+#if defined(__linux__)
+// Whether the kernel backs madvise()d memory with transparent huge pages:
+// its setting reads "[always]" or "[madvise]" rather than "[never]".
+inline bool transparent_huge_pages_available()
+{
+  static const bool available = [] {
+    std::ifstream setting("/sys/kernel/mm/transparent_hugepage/enabled");
+    std::string modes;
+    return std::getline(setting, modes) && modes.find("[never]") == std::string::npos;
+  }();
+  return available;
+}
+
+// Maps length bytes, a multiple of huge_page_size, at a huge_page_size
+// boundary; huge is set when the mapping is on explicit huge pages, and
+// transparent when it asked for transparent ones instead.
+inline void *map_large_buffer(const std::size_t length, bool &huge, bool &transparent)
+{
+  huge = transparent = false;
+#if defined(MAP_HUGETLB)
+  if (image_huge_pages()) {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#if defined(MAP_HUGE_2MB)
+    flags |= MAP_HUGE_2MB;
+#endif
+    void *p = mmap(nullptr, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (p != MAP_FAILED) { huge = true; return p; }
+  }
+#endif
+  // Over-map by a huge page and trim both ends, so the buffer starts on a
+  // huge page boundary where the kernel can back it with whole huge pages.
+  void *p = mmap(nullptr, length + huge_page_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) return nullptr;
+  char *base = static_cast<char *>(p);
+  char *aligned = reinterpret_cast<char *>(round_up(reinterpret_cast<std::uintptr_t>(base), huge_page_size));
+  if (aligned != base) munmap(base, aligned - base);
+  if (aligned + length != base + length + huge_page_size)
+    munmap(aligned + length, base + length + huge_page_size - (aligned + length));
+#if defined(MADV_HUGEPAGE)
+  if (image_huge_pages())
+    transparent = madvise(aligned, length, MADV_HUGEPAGE) == 0 && transparent_huge_pages_available();
+#endif
+  return aligned;
+}
+#endif
+
+// Allocates bytes of image_alignment aligned storage, on huge pages when it
+// is large enough and they are available. Throws std::bad_alloc on failure.
+inline void *allocate_image_memory(const std::size_t bytes)
+{
+  image_memory_counters &stats = image_memory_stats();
+  ++stats.buffers;
+  void *p = nullptr;
+  if (bytes >= huge_page_size) {
+    ++stats.large_buffers;
+    bool huge = false, transparent = false;
+#if defined(_WIN32)
+    // Large pages need the "Lock pages in memory" privilege; without it the
+    // first VirtualAlloc fails and the buffer gets ordinary pages.
+    const std::size_t large_page = GetLargePageMinimum();
+    if (image_huge_pages() && large_page != 0) {
+      p = VirtualAlloc(nullptr, round_up(bytes, large_page),
+                       MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+      huge = p != nullptr;
+    }
+    if (p == nullptr)
+      p = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#elif defined(__linux__)
+    p = map_large_buffer(round_up(bytes, huge_page_size), huge, transparent);
+#else
+    if (posix_memalign(&p, huge_page_size, bytes) != 0) p = nullptr;
+#endif
+    if (huge) ++stats.huge_page_buffers;
+    if (transparent) ++stats.transparent_buffers;
+  }
+  else {
+#if defined(_WIN32)
+    p = _aligned_malloc(bytes ? bytes : 1, image_alignment);
+#else
+    if (posix_memalign(&p, image_alignment, bytes ? bytes : 1) != 0) p = nullptr;
+#endif
+  }
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+// Frees storage from allocate_image_memory() of the same size in bytes.
+inline void release_image_memory(void *p, const std::size_t bytes)
+{
+  if (p == nullptr) return;
+  if (bytes >= huge_page_size) {
+#if defined(_WIN32)
+    VirtualFree(p, 0, MEM_RELEASE);
+#elif defined(__linux__)
+    munmap(p, round_up(bytes, huge_page_size));
+#else
+    std::free(p);
+#endif
+  }
+  else {
+#if defined(_WIN32)
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+  }
+}
+
+// A standard allocator over allocate_image_memory(). Elements are default
+// initialised rather than zeroed, so resizing a buffer of bytes does not
+// touch its pages before the first pass writes them.
+template <typename T>
+struct image_allocator {
+  typedef T value_type;
+
+  image_allocator() {}
+  template <typename U> image_allocator(const image_allocator<U> &) {}
+
+  T *allocate(const std::size_t n)
+  {
+    return static_cast<T *>(allocate_image_memory(n * sizeof(T)));
+  }
+  void deallocate(T *p, const std::size_t n) { release_image_memory(p, n * sizeof(T)); }
+
+  template <typename U> void construct(U *p) { ::new(static_cast<void *>(p)) U; }
+  template <typename U, typename... Args> void construct(U *p, Args&&... args)
+  {
+    ::new(static_cast<void *>(p)) U(std::forward<Args>(args)...);
+  }
+};
+
+template <typename T, typename U>
+bool operator==(const image_allocator<T> &, const image_allocator<U> &) { return true; }
+template <typename T, typename U>
+bool operator!=(const image_allocator<T> &, const image_allocator<U> &) { return false; }
+
+// An image frame, or any other buffer of bytes the size of one.
+typedef std::vector<unsigned char, image_allocator<unsigned char>> image_buffer;
+
+#endif // _IMAGE_BUFFER_HPP_
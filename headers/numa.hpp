@@ -0,0 +1,139 @@
+#ifndef _NUMA_HPP_
+#define _NUMA_HPP_
+
+#include <atomic>
+#include <vector>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include "thread_pool.hpp"
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// NUMA placement of the row bands a thread_pool works on. Linux puts a page
+// on the node of the thread that first writes it, so a frame whose bands are
+// first touched by the threads that later blur them is spread over the
+// nodes with each band local to its worker. A frame filled by one thread
+// sits on one node, and every other socket reaches it remotely.
+
+// The number of NUMA nodes in the system; 1 where it cannot be told.
+inline unsigned numa_node_count()
+{
+#if defined(_WIN32)
+  ULONG highest;
+  if (GetNumaHighestNodeNumber(&highest)) return highest + 1;
+#elif defined(__linux__)
+  // A list of ranges such as "0-1", of which the last number is the highest.
+  std::ifstream online("/sys/devices/system/node/online");
+  std::string ranges;
+  if (std::getline(online, ranges)) {
+    const std::string::size_type last = ranges.find_last_of(",-");
+    return std::stoul(last == std::string::npos ? ranges : ranges.substr(last + 1)) + 1;
+  }
+#endif
+  return 1;
+}
+
+// The node of the CPU the calling thread is running on, or -1.
+inline int current_numa_node()
+{
+#if defined(_WIN32)
+  PROCESSOR_NUMBER processor;
+  USHORT node;
+  GetCurrentProcessorNumberEx(&processor);
+  if (GetNumaProcessorNodeEx(&processor, &node)) return node;
+#elif defined(__linux__) && defined(SYS_getcpu)
+  unsigned cpu, node;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) return node;
+#endif
+  return -1;
+}
+
+// Writes the nodes of count pages into nodes: -1 where the page has not been
+// touched yet or the platform cannot tell.
+inline void page_numa_nodes(const void **pages, const unsigned long count, int *nodes)
+{
+#if defined(__linux__) && defined(SYS_move_pages)
+  // Without target nodes, move_pages() only reports where each page is.
+  if (syscall(SYS_move_pages, 0, count, pages, nullptr, nodes, 0) == 0) {
+    for (unsigned long i = 0; i < count; ++i)
+      if (nodes[i] < 0) nodes[i] = -1;
+    return;
+  }
+#endif
+  for (unsigned long i = 0; i < count; ++i) nodes[i] = -1;
+}
+
+const std::size_t numa_page_size = 4096;
+
+// Touches every page of rows [0,h) of data from the thread that works on
+// its band in pool.parallel_for(), so that untouched pages are placed on
+// that thread's node. The bytes are left as they were.
+inline void first_touch_rows(thread_pool &pool, unsigned char *data,
+                             const unsigned h, const std::size_t row_size)
+{
+  pool.parallel_for(0, h, [&](unsigned y_begin, unsigned y_end, unsigned) {
+    volatile unsigned char *begin = data + y_begin*row_size;
+    volatile unsigned char *end   = data + y_end*row_size;
+    for (volatile unsigned char *p = begin; p < end; p += numa_page_size)
+      *p = *p;
+  });
+}
+
+// Copies rows [0,h) of src into dst band by band on the threads of pool,
+// placing the pages of each band of dst on the node of its worker.
+inline void copy_rows_placed(thread_pool &pool, unsigned char *dst,
+                             const unsigned char *src,
+                             const unsigned h, const std::size_t row_size)
+{
+  pool.parallel_for(0, h, [&](unsigned y_begin, unsigned y_end, unsigned) {
+    std::memcpy(dst + y_begin*row_size, src + y_begin*row_size,
+                (y_end - y_begin)*row_size);
+  });
+}
+
+// How many of the pages the band workers of a pool use are on their own
+// node, and how many on another node and so reached across sockets.
+struct numa_traffic {
+  std::atomic<unsigned long> local_pages, remote_pages, unknown_pages;
+
+  numa_traffic() : local_pages(0), remote_pages(0), unknown_pages(0) {}
+
+  // The share of the known pages that are remote, from 0 to 1.
+  double remote_share() const
+  {
+    const unsigned long known = local_pages + remote_pages;
+    return known ? double(remote_pages) / known : 0.0;
+  }
+};
+
+// Adds the pages of rows [0,h) of data into traffic, each band counted by
+// the thread of pool that works on it against the node that thread runs on.
+inline void count_band_pages(thread_pool &pool, const unsigned char *data,
+                             const unsigned h, const std::size_t row_size,
+                             numa_traffic &traffic)
+{
+  pool.parallel_for(0, h, [&](unsigned y_begin, unsigned y_end, unsigned) {
+    const int node = current_numa_node();
+    std::vector<const void *> pages;
+    for (const unsigned char *p = data + y_begin*row_size; p < data + y_end*row_size;
+         p += numa_page_size)
+      pages.push_back(p);
+    std::vector<int> nodes(pages.size());
+    page_numa_nodes(pages.data(), pages.size(), nodes.data());
+
+    unsigned long local = 0, remote = 0, unknown = 0;
+    for (const int page_node : nodes) {
+      if (page_node < 0 || node < 0) ++unknown;
+      else if (page_node == node)    ++local;
+      else                           ++remote;
+    }
+    traffic.local_pages += local; traffic.remote_pages += remote;
+    traffic.unknown_pages += unknown;
+  });
+}
+
+#endif // _NUMA_HPP_
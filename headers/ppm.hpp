@@ -4,6 +4,8 @@
 /*
    A simple 24-bit Netpbm ASCII PPM "P3" loading and unloading class
    Copyright (c) 2016 Paul Keir, University of the West of Scotland.
+
+   8-bit ASCII PGM "P2" grayscale images load with a single channel.
 */
 
 #include <iostream>
@@ -13,25 +15,34 @@
 #include <climits>
 #include <cassert>
 #include <cerrno>
+#include "image_buffer.hpp"
 
 std::string get_file_contents(const char *);
 
+// The channels per pixel of a Netpbm ASCII format: 1 for a "P2" graymap,
+// 3 for a "P3" pixmap.
+inline unsigned netpbm_channels(const std::string &magic)
+{
+  return magic == "P2" ? 1 : 3;
+}
+
 struct ppm {
 
-  void read(const char *filename, std::vector<unsigned char> &data)
+  void read(const char *filename, image_buffer &data)
   {
     std::string str = get_file_contents(filename);
     capacity = str.capacity();
     std::stringstream ss(str);
     ss >> magic >> w >> h >> max;
     assert(max <= UCHAR_MAX);
+    nchannels = netpbm_channels(magic);
     data.reserve(w*h*nchannels);
     unsigned u;
     while (ss >> u)
       data.emplace_back(u); // Yes, pushing an uint into a vector of uchars
   }
 
-  void write(const char *filename, const std::vector<unsigned char> &data)
+  void write(const char *filename, const image_buffer &data)
   {
     const unsigned entries_per_line = 18;
     std::string str;
@@ -52,7 +63,57 @@ struct ppm {
   std::string magic;
   std::string::size_type capacity;
   unsigned w, h, max;
-  const unsigned nchannels= 3;  // e.g. RGB; RGBA has 4 channels
+  unsigned nchannels = 3;  // e.g. RGB; 1 for a graymap
+};
+
+// Reads the pixels of a PPM one row at a time, so that images too large to
+// hold in memory whole can be processed as they are read.
+struct ppm_row_reader {
+
+  explicit ppm_row_reader(const char *filename) : in(filename, std::ios::in)
+  {
+    if (!in) throw errno;
+    in >> magic >> w >> h >> max;
+    assert(max <= UCHAR_MAX);
+    nchannels = netpbm_channels(magic);
+  }
+
+  bool read_row(unsigned char *row)
+  {
+    unsigned u;
+    for (unsigned i = 0; i < w*nchannels; ++i) {
+      if (!(in >> u)) return false;
+      row[i] = u;
+    }
+    return true;
+  }
+
+  std::ifstream in;
+  std::string magic;
+  unsigned w, h, max, nchannels;
+};
+
+// Writes a PPM one row at a time, in the layout of ppm::write().
+struct ppm_row_writer {
+
+  ppm_row_writer(const char *filename, const std::string &magic,
+                 const unsigned w, const unsigned h, const unsigned max)
+    : out(filename, std::ios::out), w(w), count(0), nchannels(netpbm_channels(magic))
+  {
+    out << magic << '\n' << w << ' ' << h << '\n' << max << '\n';
+  }
+
+  void write_row(const unsigned char *row)
+  {
+    const unsigned entries_per_line = 18;
+    for (unsigned i = 0; i < w*nchannels; ++i) {
+      out << unsigned(row[i]) << ' ';
+      if (++count == entries_per_line) { out << '\n'; count = 0; }
+    }
+  }
+
+  std::ofstream out;
+  unsigned w, count, nchannels;
 };
 
 // http://insanecoding.blogspot.co.uk/2011/11/how-to-read-in-file-in-c.html
@@ -0,0 +1,697 @@
+#ifndef _ROW_KERNELS_HPP_
+#define _ROW_KERNELS_HPP_
+
+// The inner loops of the blurs and add_weighted, written once per vector
+// tier: a portable scalar version, SSE4.1 (16 bytes per step) and AVX2 (32
+// bytes per step). All tiers give identical bytes. The tier is picked from
+// CPUID the first time the kernels are used, and can be lowered with
+// select_row_kernels() to compare tiers.
+
+#include <cstdint>
+#include <cstddef>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include "cpu_features.hpp"
+
+#if defined(UNSHARP_X86)
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define ROW_KERNEL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define ROW_KERNEL_TARGET(isa)
+#endif
+#endif
+
+// The weights of add_weighted() as integers over a power of two, when they
+// can be: out = saturate((a*in1 + b*in2 + g) >> shift). This is exact when
+// alpha, beta and gamma are multiples of 1/2^shift small enough for 16-bit
+// lanes, as the unsharp mask's 1.5 and -0.5 are.
+struct fixed_weights {
+  fixed_weights(const float alpha, const float beta, const float gamma)
+    : exact(false), a(0), b(0), g(0), shift(0)
+  {
+    for (int k = 0; k <= 7 && !exact; ++k) {
+      const float scale = float(1 << k);
+      const float sa = alpha*scale, sb = beta*scale, sg = gamma*scale;
+      if (sa != std::floor(sa) || sb != std::floor(sb) || sg != std::floor(sg))
+        continue;
+      if (std::fabs(sa)*UCHAR_MAX + std::fabs(sb)*UCHAR_MAX + std::fabs(sg) > SHRT_MAX)
+        break;
+      a = (short)sa; b = (short)sb; g = (short)sg; shift = k; exact = true;
+    }
+  }
+
+  bool exact;
+  short a, b, g;
+  int shift;
+};
+
+namespace row_scalar {
+
+void add_row(unsigned *totals, const unsigned char *row, const unsigned n)
+{
+  for (unsigned i = 0; i < n; ++i)
+    totals[i] += row[i];
+}
+
+void slide_rows(unsigned *totals, const unsigned char *enter,
+                const unsigned char *leave, const unsigned n)
+{
+  for (unsigned i = 0; i < n; ++i)
+    totals[i] += enter[i] - leave[i];
+}
+
+// add_row() and slide_rows() on 16-bit totals, for windows of at most 257
+// rows, whose totals fit. Intermediate sums wrap, which leaves the final
+// total exact.
+void add_row16(uint16_t *totals, const unsigned char *row, const unsigned n)
+{
+  for (unsigned i = 0; i < n; ++i)
+    totals[i] = uint16_t(totals[i] + row[i]);
+}
+
+void slide_rows16(uint16_t *totals, const unsigned char *enter,
+                  const unsigned char *leave, const unsigned n)
+{
+  for (unsigned i = 0; i < n; ++i)
+    totals[i] = uint16_t(totals[i] + enter[i] - leave[i]);
+}
+
+void divide_row(unsigned char *out, const unsigned *totals, const unsigned n,
+                const uint64_t multiplier, const unsigned bias, const unsigned shift)
+{
+  for (unsigned i = 0; i < n; ++i)
+    out[i] = (unsigned char)((uint64_t(totals[i] + bias) * multiplier) >> shift);
+}
+
+void add_weighted_row(unsigned char *out,
+                      const unsigned char *in1, const float alpha,
+                      const unsigned char *in2, const float beta, const float gamma,
+                      const unsigned n)
+{
+  for (unsigned i = 0; i < n; ++i) {
+    const float tmp = in1[i] * alpha + in2[i] * beta + gamma;
+    out[i] = tmp < 0 ? 0 : tmp > UCHAR_MAX ? UCHAR_MAX : tmp;
+  }
+}
+
+// Splits npixels interleaved pixels into planes: channel c of pixel i goes
+// to planes[c*plane_size + i].
+void deinterleave(unsigned char *planes, const std::size_t plane_size,
+                  const unsigned char *in, const unsigned npixels, const unsigned nchannels)
+{
+  for (unsigned i = 0; i < npixels; ++i)
+    for (unsigned c = 0; c < nchannels; ++c)
+      planes[c*plane_size + i] = in[i*nchannels + c];
+}
+
+// The inverse of deinterleave().
+void interleave(unsigned char *out, const unsigned char *planes, const std::size_t plane_size,
+                const unsigned npixels, const unsigned nchannels)
+{
+  for (unsigned i = 0; i < npixels; ++i)
+    for (unsigned c = 0; c < nchannels; ++c)
+      out[i*nchannels + c] = planes[c*plane_size + i];
+}
+
+// Widens npixels RGB pixels to RGBX, with X = 0.
+void pad_rgbx(unsigned char *out, const unsigned char *in, const unsigned npixels)
+{
+  for (unsigned i = 0; i < npixels; ++i) {
+    out[4*i + 0] = in[3*i + 0]; out[4*i + 1] = in[3*i + 1];
+    out[4*i + 2] = in[3*i + 2]; out[4*i + 3] = 0;
+  }
+}
+
+// Narrows npixels RGBX pixels to RGB, dropping X.
+void unpad_rgbx(unsigned char *out, const unsigned char *in, const unsigned npixels)
+{
+  for (unsigned i = 0; i < npixels; ++i) {
+    out[3*i + 0] = in[4*i + 0]; out[3*i + 1] = in[4*i + 1]; out[3*i + 2] = in[4*i + 2];
+  }
+}
+
+// Transposes a block of rows x cols 32-bit elements: element (y,x) of in
+// goes to (x,y) of out. The strides are in elements.
+void transpose_block32(uint32_t *out, const std::size_t out_stride,
+                       const uint32_t *in, const std::size_t in_stride,
+                       const unsigned rows, const unsigned cols)
+{
+  for (unsigned y = 0; y < rows; ++y)
+    for (unsigned x = 0; x < cols; ++x)
+      out[x*out_stride + y] = in[y*in_stride + x];
+}
+
+} // namespace row_scalar
+
+#if defined(UNSHARP_X86)
+namespace row_sse41 {
+
+ROW_KERNEL_TARGET("sse4.1")
+void add_row(unsigned *totals, const unsigned char *row, const unsigned n)
+{
+  unsigned i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m128i bytes = _mm_loadu_si128((const __m128i *)(row + i));
+    const __m128i quads[4] = { _mm_cvtepu8_epi32(bytes), _mm_cvtepu8_epi32(_mm_srli_si128(bytes, 4)),
+                               _mm_cvtepu8_epi32(_mm_srli_si128(bytes, 8)), _mm_cvtepu8_epi32(_mm_srli_si128(bytes, 12)) };
+    for (int q = 0; q < 4; ++q) {
+      __m128i *t = (__m128i *)(totals + i + 4*q);
+      _mm_storeu_si128(t, _mm_add_epi32(_mm_loadu_si128(t), quads[q]));
+    }
+  }
+  row_scalar::add_row(totals + i, row + i, n - i);
+}
+
+ROW_KERNEL_TARGET("sse4.1")
+void slide_rows(unsigned *totals, const unsigned char *enter,
+                const unsigned char *leave, const unsigned n)
+{
+  unsigned i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m128i e = _mm_loadu_si128((const __m128i *)(enter + i));
+    const __m128i l = _mm_loadu_si128((const __m128i *)(leave + i));
+    const __m128i lo = _mm_sub_epi16(_mm_cvtepu8_epi16(e), _mm_cvtepu8_epi16(l));
+    const __m128i hi = _mm_sub_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(e, 8)),
+                                     _mm_cvtepu8_epi16(_mm_srli_si128(l, 8)));
+    const __m128i diffs[4] = { _mm_cvtepi16_epi32(lo), _mm_cvtepi16_epi32(_mm_srli_si128(lo, 8)),
+                               _mm_cvtepi16_epi32(hi), _mm_cvtepi16_epi32(_mm_srli_si128(hi, 8)) };
+    for (int q = 0; q < 4; ++q) {
+      __m128i *t = (__m128i *)(totals + i + 4*q);
+      _mm_storeu_si128(t, _mm_add_epi32(_mm_loadu_si128(t), diffs[q]));
+    }
+  }
+  row_scalar::slide_rows(totals + i, enter + i, leave + i, n - i);
+}
+
+// Eight 16-bit totals per vector rather than four 32-bit ones, and no
+// widening beyond 16 bits.
+ROW_KERNEL_TARGET("sse4.1")
+void add_row16(uint16_t *totals, const unsigned char *row, const unsigned n)
+{
+  unsigned i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m128i bytes = _mm_loadu_si128((const __m128i *)(row + i));
+    __m128i *t = (__m128i *)(totals + i);
+    _mm_storeu_si128(t+0, _mm_add_epi16(_mm_loadu_si128(t+0), _mm_cvtepu8_epi16(bytes)));
+    _mm_storeu_si128(t+1, _mm_add_epi16(_mm_loadu_si128(t+1), _mm_cvtepu8_epi16(_mm_srli_si128(bytes, 8))));
+  }
+  row_scalar::add_row16(totals + i, row + i, n - i);
+}
+
+ROW_KERNEL_TARGET("sse4.1")
+void slide_rows16(uint16_t *totals, const unsigned char *enter,
+                  const unsigned char *leave, const unsigned n)
+{
+  unsigned i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m128i e = _mm_loadu_si128((const __m128i *)(enter + i));
+    const __m128i l = _mm_loadu_si128((const __m128i *)(leave + i));
+    const __m128i lo = _mm_sub_epi16(_mm_cvtepu8_epi16(e), _mm_cvtepu8_epi16(l));
+    const __m128i hi = _mm_sub_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(e, 8)),
+                                     _mm_cvtepu8_epi16(_mm_srli_si128(l, 8)));
+    __m128i *t = (__m128i *)(totals + i);
+    _mm_storeu_si128(t+0, _mm_add_epi16(_mm_loadu_si128(t+0), lo));
+    _mm_storeu_si128(t+1, _mm_add_epi16(_mm_loadu_si128(t+1), hi));
+  }
+  row_scalar::slide_rows16(totals + i, enter + i, leave + i, n - i);
+}
+
+// ((t + bias) * multiplier) >> shift for four 32-bit totals. The multiplier
+// is below 2^32 (see box_divisor), so 32x32->64 bit products suffice.
+ROW_KERNEL_TARGET("sse4.1")
+inline __m128i divide4(const __m128i totals, const __m128i bias,
+                       const __m128i multiplier, const __m128i shift)
+{
+  const __m128i t = _mm_add_epi32(totals, bias);
+  const __m128i even = _mm_srl_epi64(_mm_mul_epu32(t, multiplier), shift);
+  const __m128i odd  = _mm_srl_epi64(_mm_mul_epu32(_mm_srli_epi64(t, 32), multiplier), shift);
+  return _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+}
+
+ROW_KERNEL_TARGET("sse4.1")
+void divide_row(unsigned char *out, const unsigned *totals, const unsigned n,
+                const uint64_t multiplier, const unsigned bias, const unsigned shift)
+{
+  const __m128i m = _mm_set1_epi32((int)multiplier);
+  const __m128i b = _mm_set1_epi32((int)bias);
+  const __m128i s = _mm_cvtsi32_si128((int)shift);
+  unsigned i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const __m128i *t = (const __m128i *)(totals + i);
+    const __m128i q0 = divide4(_mm_loadu_si128(t+0), b, m, s);
+    const __m128i q1 = divide4(_mm_loadu_si128(t+1), b, m, s);
+    const __m128i q2 = divide4(_mm_loadu_si128(t+2), b, m, s);
+    const __m128i q3 = divide4(_mm_loadu_si128(t+3), b, m, s);
+    _mm_storeu_si128((__m128i *)(out + i),
+      _mm_packus_epi16(_mm_packus_epi32(q0, q1), _mm_packus_epi32(q2, q3)));
+  }
+  row_scalar::divide_row(out + i, totals + i, n - i, multiplier, bias, shift);
+}
+
+ROW_KERNEL_TARGET("sse4.1")
+inline __m128i weigh4(const unsigned char *in1, const __m128 alpha,
+                      const unsigned char *in2, const __m128 beta, const __m128 gamma)
+{
+  int x, y;
+  std::memcpy(&x, in1, sizeof x); std::memcpy(&y, in2, sizeof y);
+  const __m128 a = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(x)));
+  const __m128 b = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(y)));
+  const __m128 tmp = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, alpha), _mm_mul_ps(b, beta)), gamma);
+  return _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(tmp, _mm_setzero_ps()), _mm_set1_ps(UCHAR_MAX)));
+}
+
+ROW_KERNEL_TARGET("sse4.1")
+void add_weighted_row(unsigned char *out,
+                      const unsigned char *in1, const float alpha,
+                      const unsigned char *in2, const float beta, const float gamma,
+                      const unsigned n)
+{
+  const fixed_weights fixed(alpha, beta, gamma);
+  unsigned i = 0;
+  if (fixed.exact) {
+    const __m128i a = _mm_set1_epi16(fixed.a), b = _mm_set1_epi16(fixed.b);
+    const __m128i g = _mm_set1_epi16(fixed.g), s = _mm_cvtsi32_si128(fixed.shift);
+    for (; i + 16 <= n; i += 16) {
+      const __m128i x = _mm_loadu_si128((const __m128i *)(in1 + i));
+      const __m128i y = _mm_loadu_si128((const __m128i *)(in2 + i));
+      const __m128i lo = _mm_sra_epi16(_mm_add_epi16(_mm_add_epi16(
+        _mm_mullo_epi16(_mm_cvtepu8_epi16(x), a), _mm_mullo_epi16(_mm_cvtepu8_epi16(y), b)), g), s);
+      const __m128i hi = _mm_sra_epi16(_mm_add_epi16(_mm_add_epi16(
+        _mm_mullo_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(x, 8)), a),
+        _mm_mullo_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(y, 8)), b)), g), s);
+      _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(lo, hi));
+    }
+  }
+  else {
+    const __m128 a = _mm_set1_ps(alpha), b = _mm_set1_ps(beta), g = _mm_set1_ps(gamma);
+    for (; i + 16 <= n; i += 16) {
+      const __m128i q0 = weigh4(in1 + i +  0, a, in2 + i +  0, b, g);
+      const __m128i q1 = weigh4(in1 + i +  4, a, in2 + i +  4, b, g);
+      const __m128i q2 = weigh4(in1 + i +  8, a, in2 + i +  8, b, g);
+      const __m128i q3 = weigh4(in1 + i + 12, a, in2 + i + 12, b, g);
+      _mm_storeu_si128((__m128i *)(out + i),
+        _mm_packus_epi16(_mm_packus_epi32(q0, q1), _mm_packus_epi32(q2, q3)));
+    }
+  }
+  row_scalar::add_weighted_row(out + i, in1 + i, alpha, in2 + i, beta, gamma, n - i);
+}
+
+// 16 RGB pixels at a time: each plane's 16 bytes are gathered from the
+// three 16-byte blocks of 48 interleaved bytes by one shuffle per block.
+// Other channel counts use the scalar loop.
+ROW_KERNEL_TARGET("sse4.1")
+void deinterleave(unsigned char *planes, const std::size_t plane_size,
+                  const unsigned char *in, const unsigned npixels, const unsigned nchannels)
+{
+  // [channel][block]; -1 zeroes the byte.
+  static const signed char masks[3][3][16] = {
+    { { 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13 } },
+    { { 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14 } },
+    { { 2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15 } } };
+
+  unsigned i = 0;
+  if (nchannels == 3) {
+    for (; i + 16 <= npixels; i += 16) {
+      const __m128i blocks[3] = { _mm_loadu_si128((const __m128i *)(in + 3*i)),
+                                  _mm_loadu_si128((const __m128i *)(in + 3*i + 16)),
+                                  _mm_loadu_si128((const __m128i *)(in + 3*i + 32)) };
+      for (int c = 0; c < 3; ++c) {
+        __m128i plane = _mm_setzero_si128();
+        for (int b = 0; b < 3; ++b)
+          plane = _mm_or_si128(plane, _mm_shuffle_epi8(blocks[b], _mm_loadu_si128((const __m128i *)masks[c][b])));
+        _mm_storeu_si128((__m128i *)(planes + c*plane_size + i), plane);
+      }
+    }
+  }
+  row_scalar::deinterleave(planes + i, plane_size, in + i*nchannels, npixels - i, nchannels);
+}
+
+// The inverse of deinterleave(): each 16-byte block of interleaved output
+// is gathered from the three planes by one shuffle per plane.
+ROW_KERNEL_TARGET("sse4.1")
+void interleave(unsigned char *out, const unsigned char *planes, const std::size_t plane_size,
+                const unsigned npixels, const unsigned nchannels)
+{
+  // [block][channel]; -1 zeroes the byte.
+  static const signed char masks[3][3][16] = {
+    { { 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5 },
+      { -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1 },
+      { -1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1 } },
+    { { -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1 },
+      { 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10 },
+      { -1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1 } },
+    { { -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1 },
+      { -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1 },
+      { 10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15 } } };
+
+  unsigned i = 0;
+  if (nchannels == 3) {
+    for (; i + 16 <= npixels; i += 16) {
+      const __m128i channels[3] = { _mm_loadu_si128((const __m128i *)(planes + i)),
+                                    _mm_loadu_si128((const __m128i *)(planes + plane_size + i)),
+                                    _mm_loadu_si128((const __m128i *)(planes + 2*plane_size + i)) };
+      for (int b = 0; b < 3; ++b) {
+        __m128i block = _mm_setzero_si128();
+        for (int c = 0; c < 3; ++c)
+          block = _mm_or_si128(block, _mm_shuffle_epi8(channels[c], _mm_loadu_si128((const __m128i *)masks[b][c])));
+        _mm_storeu_si128((__m128i *)(out + 3*i + 16*b), block);
+      }
+    }
+  }
+  row_scalar::interleave(out + i*nchannels, planes + i, plane_size, npixels - i, nchannels);
+}
+
+// Four pixels per step, by one shuffle of a 16-byte load; the load reaches
+// 4 bytes past the 12 used, so the last few pixels are left to the scalar
+// loop.
+ROW_KERNEL_TARGET("sse4.1")
+void pad_rgbx(unsigned char *out, const unsigned char *in, const unsigned npixels)
+{
+  const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  unsigned i = 0;
+  for (; i + 6 <= npixels; i += 4)
+    _mm_storeu_si128((__m128i *)(out + 4*i),
+                     _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 3*i)), spread));
+  row_scalar::pad_rgbx(out + 4*i, in + 3*i, npixels - i);
+}
+
+// Four pixels per step; each 16-byte store writes 4 bytes past the 12
+// kept, which the next step overwrites, so the last few pixels are left to
+// the scalar loop.
+ROW_KERNEL_TARGET("sse4.1")
+void unpad_rgbx(unsigned char *out, const unsigned char *in, const unsigned npixels)
+{
+  const __m128i gather = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  unsigned i = 0;
+  for (; i + 6 <= npixels; i += 4)
+    _mm_storeu_si128((__m128i *)(out + 3*i),
+                     _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 4*i)), gather));
+  row_scalar::unpad_rgbx(out + 3*i, in + 4*i, npixels - i);
+}
+
+// 4x4 elements per step, by two rounds of unpacks; the edges of a block
+// that are not a multiple of 4 are left to the scalar loop.
+ROW_KERNEL_TARGET("sse4.1")
+void transpose_block32(uint32_t *out, const std::size_t out_stride,
+                       const uint32_t *in, const std::size_t in_stride,
+                       const unsigned rows, const unsigned cols)
+{
+  unsigned y = 0;
+  for (; y + 4 <= rows; y += 4) {
+    unsigned x = 0;
+    for (; x + 4 <= cols; x += 4) {
+      const uint32_t *src = in + y*in_stride + x;
+      const __m128i r0 = _mm_loadu_si128((const __m128i *)(src));
+      const __m128i r1 = _mm_loadu_si128((const __m128i *)(src +   in_stride));
+      const __m128i r2 = _mm_loadu_si128((const __m128i *)(src + 2*in_stride));
+      const __m128i r3 = _mm_loadu_si128((const __m128i *)(src + 3*in_stride));
+      const __m128i t0 = _mm_unpacklo_epi32(r0, r1), t1 = _mm_unpackhi_epi32(r0, r1);
+      const __m128i t2 = _mm_unpacklo_epi32(r2, r3), t3 = _mm_unpackhi_epi32(r2, r3);
+      uint32_t *dst = out + x*out_stride + y;
+      _mm_storeu_si128((__m128i *)(dst),                _mm_unpacklo_epi64(t0, t2));
+      _mm_storeu_si128((__m128i *)(dst +   out_stride), _mm_unpackhi_epi64(t0, t2));
+      _mm_storeu_si128((__m128i *)(dst + 2*out_stride), _mm_unpacklo_epi64(t1, t3));
+      _mm_storeu_si128((__m128i *)(dst + 3*out_stride), _mm_unpackhi_epi64(t1, t3));
+    }
+    row_scalar::transpose_block32(out + x*out_stride + y, out_stride,
+                                  in + y*in_stride + x, in_stride, 4, cols - x);
+  }
+  row_scalar::transpose_block32(out + y, out_stride, in + y*in_stride, in_stride,
+                                rows - y, cols);
+}
+
+} // namespace row_sse41
+
+namespace row_avx2 {
+
+ROW_KERNEL_TARGET("avx2")
+void add_row(unsigned *totals, const unsigned char *row, const unsigned n)
+{
+  unsigned i = 0;
+  for (; i + 32 <= n; i += 32) {
+    for (int q = 0; q < 4; ++q) {
+      __m256i *t = (__m256i *)(totals + i + 8*q);
+      const __m256i bytes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(row + i + 8*q)));
+      _mm256_storeu_si256(t, _mm256_add_epi32(_mm256_loadu_si256(t), bytes));
+    }
+  }
+  row_scalar::add_row(totals + i, row + i, n - i);
+}
+
+ROW_KERNEL_TARGET("avx2")
+void slide_rows(unsigned *totals, const unsigned char *enter,
+                const unsigned char *leave, const unsigned n)
+{
+  unsigned i = 0;
+  for (; i + 32 <= n; i += 32) {
+    for (int h = 0; h < 2; ++h) {
+      const __m256i diff = _mm256_sub_epi16(
+        _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(enter + i + 16*h))),
+        _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(leave + i + 16*h))));
+      __m256i *t = (__m256i *)(totals + i + 16*h);
+      _mm256_storeu_si256(t+0, _mm256_add_epi32(_mm256_loadu_si256(t+0),
+        _mm256_cvtepi16_epi32(_mm256_castsi256_si128(diff))));
+      _mm256_storeu_si256(t+1, _mm256_add_epi32(_mm256_loadu_si256(t+1),
+        _mm256_cvtepi16_epi32(_mm256_extracti128_si256(diff, 1))));
+    }
+  }
+  row_scalar::slide_rows(totals + i, enter + i, leave + i, n - i);
+}
+
+ROW_KERNEL_TARGET("avx2")
+void add_row16(uint16_t *totals, const unsigned char *row, const unsigned n)
+{
+  unsigned i = 0;
+  for (; i + 32 <= n; i += 32) {
+    for (int h = 0; h < 2; ++h) {
+      __m256i *t = (__m256i *)(totals + i + 16*h);
+      const __m256i bytes = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(row + i + 16*h)));
+      _mm256_storeu_si256(t, _mm256_add_epi16(_mm256_loadu_si256(t), bytes));
+    }
+  }
+  row_scalar::add_row16(totals + i, row + i, n - i);
+}
+
+ROW_KERNEL_TARGET("avx2")
+void slide_rows16(uint16_t *totals, const unsigned char *enter,
+                  const unsigned char *leave, const unsigned n)
+{
+  unsigned i = 0;
+  for (; i + 32 <= n; i += 32) {
+    for (int h = 0; h < 2; ++h) {
+      const __m256i diff = _mm256_sub_epi16(
+        _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(enter + i + 16*h))),
+        _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(leave + i + 16*h))));
+      __m256i *t = (__m256i *)(totals + i + 16*h);
+      _mm256_storeu_si256(t, _mm256_add_epi16(_mm256_loadu_si256(t), diff));
+    }
+  }
+  row_scalar::slide_rows16(totals + i, enter + i, leave + i, n - i);
+}
+
+ROW_KERNEL_TARGET("avx2")
+inline __m256i divide8(const __m256i totals, const __m256i bias,
+                       const __m256i multiplier, const __m128i shift)
+{
+  const __m256i t = _mm256_add_epi32(totals, bias);
+  const __m256i even = _mm256_srl_epi64(_mm256_mul_epu32(t, multiplier), shift);
+  const __m256i odd  = _mm256_srl_epi64(_mm256_mul_epu32(_mm256_srli_epi64(t, 32), multiplier), shift);
+  return _mm256_or_si256(even, _mm256_slli_epi64(odd, 32));
+}
+
+// Packs 32 values of 0-255 held in four vectors of 32-bit lanes into bytes,
+// undoing the per-128-bit-lane interleave of the AVX2 pack instructions.
+ROW_KERNEL_TARGET("avx2")
+inline __m256i pack32(const __m256i q0, const __m256i q1, const __m256i q2, const __m256i q3)
+{
+  const __m256i bytes = _mm256_packus_epi16(_mm256_packus_epi32(q0, q1), _mm256_packus_epi32(q2, q3));
+  return _mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+ROW_KERNEL_TARGET("avx2")
+void divide_row(unsigned char *out, const unsigned *totals, const unsigned n,
+                const uint64_t multiplier, const unsigned bias, const unsigned shift)
+{
+  const __m256i m = _mm256_set1_epi32((int)multiplier);
+  const __m256i b = _mm256_set1_epi32((int)bias);
+  const __m128i s = _mm_cvtsi32_si128((int)shift);
+  unsigned i = 0;
+  for (; i + 32 <= n; i += 32) {
+    const __m256i *t = (const __m256i *)(totals + i);
+    _mm256_storeu_si256((__m256i *)(out + i), pack32(
+      divide8(_mm256_loadu_si256(t+0), b, m, s), divide8(_mm256_loadu_si256(t+1), b, m, s),
+      divide8(_mm256_loadu_si256(t+2), b, m, s), divide8(_mm256_loadu_si256(t+3), b, m, s)));
+  }
+  row_scalar::divide_row(out + i, totals + i, n - i, multiplier, bias, shift);
+}
+
+ROW_KERNEL_TARGET("avx2")
+inline __m256i weigh8(const unsigned char *in1, const __m256 alpha,
+                      const unsigned char *in2, const __m256 beta, const __m256 gamma)
+{
+  const __m256 a = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)in1)));
+  const __m256 b = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)in2)));
+  const __m256 tmp = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a, alpha), _mm256_mul_ps(b, beta)), gamma);
+  return _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(tmp, _mm256_setzero_ps()), _mm256_set1_ps(UCHAR_MAX)));
+}
+
+ROW_KERNEL_TARGET("avx2")
+void add_weighted_row(unsigned char *out,
+                      const unsigned char *in1, const float alpha,
+                      const unsigned char *in2, const float beta, const float gamma,
+                      const unsigned n)
+{
+  const fixed_weights fixed(alpha, beta, gamma);
+  unsigned i = 0;
+  if (fixed.exact) {
+    const __m256i a = _mm256_set1_epi16(fixed.a), b = _mm256_set1_epi16(fixed.b);
+    const __m256i g = _mm256_set1_epi16(fixed.g);
+    const __m128i s = _mm_cvtsi32_si128(fixed.shift);
+    for (; i + 32 <= n; i += 32) {
+      const __m128i *x = (const __m128i *)(in1 + i), *y = (const __m128i *)(in2 + i);
+      const __m256i lo = _mm256_sra_epi16(_mm256_add_epi16(_mm256_add_epi16(
+        _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128(x+0)), a),
+        _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128(y+0)), b)), g), s);
+      const __m256i hi = _mm256_sra_epi16(_mm256_add_epi16(_mm256_add_epi16(
+        _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128(x+1)), a),
+        _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128(y+1)), b)), g), s);
+      _mm256_storeu_si256((__m256i *)(out + i),
+        _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8));
+    }
+  }
+  else {
+    const __m256 a = _mm256_set1_ps(alpha), b = _mm256_set1_ps(beta), g = _mm256_set1_ps(gamma);
+    for (; i + 32 <= n; i += 32) {
+      _mm256_storeu_si256((__m256i *)(out + i), pack32(
+        weigh8(in1 + i +  0, a, in2 + i +  0, b, g), weigh8(in1 + i +  8, a, in2 + i +  8, b, g),
+        weigh8(in1 + i + 16, a, in2 + i + 16, b, g), weigh8(in1 + i + 24, a, in2 + i + 24, b, g)));
+    }
+  }
+  row_scalar::add_weighted_row(out + i, in1 + i, alpha, in2 + i, beta, gamma, n - i);
+}
+
+// 8x8 elements per step: the unpacks transpose the 4x4 quarters within
+// each 128-bit lane, and the lane permutes swap the off-diagonal quarters.
+ROW_KERNEL_TARGET("avx2")
+void transpose_block32(uint32_t *out, const std::size_t out_stride,
+                       const uint32_t *in, const std::size_t in_stride,
+                       const unsigned rows, const unsigned cols)
+{
+  unsigned y = 0;
+  for (; y + 8 <= rows; y += 8) {
+    unsigned x = 0;
+    for (; x + 8 <= cols; x += 8) {
+      const uint32_t *src = in + y*in_stride + x;
+      __m256i r[8], t[8];
+      for (unsigned i = 0; i < 8; ++i)
+        r[i] = _mm256_loadu_si256((const __m256i *)(src + i*in_stride));
+      for (unsigned i = 0; i < 8; i += 2) {
+        t[i]   = _mm256_unpacklo_epi32(r[i], r[i+1]);
+        t[i+1] = _mm256_unpackhi_epi32(r[i], r[i+1]);
+      }
+      for (unsigned i = 0; i < 8; i += 4) {
+        r[i]   = _mm256_unpacklo_epi64(t[i],   t[i+2]);
+        r[i+1] = _mm256_unpackhi_epi64(t[i],   t[i+2]);
+        r[i+2] = _mm256_unpacklo_epi64(t[i+1], t[i+3]);
+        r[i+3] = _mm256_unpackhi_epi64(t[i+1], t[i+3]);
+      }
+      uint32_t *dst = out + x*out_stride + y;
+      for (unsigned i = 0; i < 4; ++i) {
+        _mm256_storeu_si256((__m256i *)(dst + i*out_stride),
+                            _mm256_permute2x128_si256(r[i], r[i+4], 0x20));
+        _mm256_storeu_si256((__m256i *)(dst + (i+4)*out_stride),
+                            _mm256_permute2x128_si256(r[i], r[i+4], 0x31));
+      }
+    }
+    row_sse41::transpose_block32(out + x*out_stride + y, out_stride,
+                                 in + y*in_stride + x, in_stride, 8, cols - x);
+  }
+  row_sse41::transpose_block32(out + y, out_stride, in + y*in_stride, in_stride,
+                               rows - y, cols);
+}
+
+} // namespace row_avx2
+#endif // UNSHARP_X86
+
+// One tier's set of row kernels.
+struct row_kernels {
+  simd_tier tier;
+  void (*add_row)(unsigned *totals, const unsigned char *row, unsigned n);
+  void (*slide_rows)(unsigned *totals, const unsigned char *enter,
+                     const unsigned char *leave, unsigned n);
+  void (*add_row16)(uint16_t *totals, const unsigned char *row, unsigned n);
+  void (*slide_rows16)(uint16_t *totals, const unsigned char *enter,
+                       const unsigned char *leave, unsigned n);
+  void (*divide_row)(unsigned char *out, const unsigned *totals, unsigned n,
+                     uint64_t multiplier, unsigned bias, unsigned shift);
+  void (*add_weighted_row)(unsigned char *out,
+                           const unsigned char *in1, float alpha,
+                           const unsigned char *in2, float beta, float gamma,
+                           unsigned n);
+  void (*deinterleave)(unsigned char *planes, std::size_t plane_size,
+                       const unsigned char *in, unsigned npixels, unsigned nchannels);
+  void (*interleave)(unsigned char *out, const unsigned char *planes, std::size_t plane_size,
+                     unsigned npixels, unsigned nchannels);
+  void (*pad_rgbx)(unsigned char *out, const unsigned char *in, unsigned npixels);
+  void (*unpad_rgbx)(unsigned char *out, const unsigned char *in, unsigned npixels);
+  void (*transpose_block32)(uint32_t *out, std::size_t out_stride,
+                            const uint32_t *in, std::size_t in_stride,
+                            unsigned rows, unsigned cols);
+};
+
+inline row_kernels make_row_kernels(const simd_tier tier)
+{
+#if defined(UNSHARP_X86)
+  // The 3-byte stride of RGB gains nothing from 32-byte shuffles, which
+  // cannot cross 128-bit lanes, so AVX2 keeps the SSE4.1 layout and padding
+  // conversions.
+  if (tier == simd_tier::avx2)
+    return { tier, row_avx2::add_row, row_avx2::slide_rows,
+             row_avx2::add_row16, row_avx2::slide_rows16,
+             row_avx2::divide_row, row_avx2::add_weighted_row,
+             row_sse41::deinterleave, row_sse41::interleave,
+             row_sse41::pad_rgbx, row_sse41::unpad_rgbx,
+             row_avx2::transpose_block32 };
+  if (tier == simd_tier::sse41)
+    return { tier, row_sse41::add_row, row_sse41::slide_rows,
+             row_sse41::add_row16, row_sse41::slide_rows16,
+             row_sse41::divide_row, row_sse41::add_weighted_row,
+             row_sse41::deinterleave, row_sse41::interleave,
+             row_sse41::pad_rgbx, row_sse41::unpad_rgbx,
+             row_sse41::transpose_block32 };
+#endif
+  return { simd_tier::scalar, row_scalar::add_row, row_scalar::slide_rows,
+           row_scalar::add_row16, row_scalar::slide_rows16,
+           row_scalar::divide_row, row_scalar::add_weighted_row,
+           row_scalar::deinterleave, row_scalar::interleave,
+           row_scalar::pad_rgbx, row_scalar::unpad_rgbx,
+           row_scalar::transpose_block32 };
+}
+
+// The row kernels in use: the widest tier CPUID reports, detected on first
+// use, unless select_row_kernels() has lowered it.
+inline row_kernels &active_row_kernels()
+{
+  static row_kernels kernels = make_row_kernels(detect_simd_tier());
+  return kernels;
+}
+
+// Lowers the tier in use, e.g. to benchmark the narrower ones; tiers the
+// host does not support are capped to the detected one.
+inline simd_tier select_row_kernels(simd_tier tier)
+{
+  const simd_tier detected = detect_simd_tier();
+  if (tier > detected) tier = detected;
+  active_row_kernels() = make_row_kernels(tier);
+  return tier;
+}
+
+#endif // _ROW_KERNELS_HPP_
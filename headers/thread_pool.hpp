@@ -0,0 +1,203 @@
+#ifndef _THREAD_POOL_HPP_
+#define _THREAD_POOL_HPP_
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// The CPUs this process may run on, in increasing order; empty where the
+// platform does not say.
+inline std::vector<unsigned> allowed_cpus()
+{
+  std::vector<unsigned> cpus;
+#if defined(_WIN32)
+  DWORD_PTR process_mask, system_mask;
+  if (GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask))
+    for (unsigned cpu = 0; cpu < 8*sizeof(DWORD_PTR); ++cpu)
+      if (process_mask & (DWORD_PTR(1) << cpu)) cpus.push_back(cpu);
+#elif defined(__linux__)
+  cpu_set_t mask;
+  if (sched_getaffinity(0, sizeof mask, &mask) == 0)
+    for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+      if (CPU_ISSET(cpu, &mask)) cpus.push_back(cpu);
+#endif
+  return cpus;
+}
+
+// A thread's CPU affinity as pin_current_thread() found it.
+struct thread_affinity {
+  bool saved = false;
+#if defined(_WIN32)
+  DWORD_PTR mask = 0;
+#elif defined(__linux__)
+  cpu_set_t mask;
+#endif
+};
+
+// Restricts the calling thread to run on cpu only, saving the affinity it
+// had in previous, when given, for restore_current_thread().
+inline bool pin_current_thread(const unsigned cpu, thread_affinity *previous = nullptr)
+{
+#if defined(_WIN32)
+  const DWORD_PTR old_mask = SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu);
+  if (previous) { previous->mask = old_mask; previous->saved = old_mask != 0; }
+  return old_mask != 0;
+#elif defined(__linux__)
+  if (previous)
+    previous->saved = pthread_getaffinity_np(pthread_self(), sizeof previous->mask, &previous->mask) == 0;
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  CPU_SET(cpu, &mask);
+  const bool pinned = pthread_setaffinity_np(pthread_self(), sizeof mask, &mask) == 0;
+  if (previous && !pinned) previous->saved = false;
+  return pinned;
+#else
+  (void)cpu; (void)previous;
+  return false;
+#endif
+}
+
+// Gives the calling thread back the affinity pin_current_thread() saved.
+inline void restore_current_thread(const thread_affinity &previous)
+{
+  if (!previous.saved) return;
+#if defined(_WIN32)
+  SetThreadAffinityMask(GetCurrentThread(), previous.mask);
+#elif defined(__linux__)
+  pthread_setaffinity_np(pthread_self(), sizeof previous.mask, &previous.mask);
+#endif
+}
+
+// A fixed set of worker threads, created once and reused for every
+// parallel_for() so no thread is started per call. The calling thread
+// works on the first band itself, so a pool of n threads runs n-1 workers.
+//
+// A pinned pool ties thread t to the t-th CPU the process may use, the
+// calling thread included, so band t is always worked on by the same core.
+// Memory a band first touches is then placed on that core's NUMA node and
+// stays local to it on every later pass. The calling thread gets its own
+// affinity back when the pool is destroyed, which must then happen on the
+// thread that created it.
+class thread_pool {
+public:
+  explicit thread_pool(unsigned nthreads = std::thread::hardware_concurrency(),
+                       const bool pin = false)
+    : nthreads(nthreads ? nthreads : 1), generation(0), pending(0), stopping(false),
+      pinned(false)
+  {
+    // The CPUs are listed before pinning the calling thread, which the
+    // workers would otherwise inherit.
+    std::vector<unsigned> cpus;
+    if (pin) cpus = allowed_cpus();
+    for (unsigned t = 1; t < this->nthreads; ++t)
+      workers.emplace_back(&thread_pool::work, this, t,
+                           cpus.empty() ? -1 : (int)cpus[t % cpus.size()]);
+    if (!cpus.empty())
+      pinned = pin_current_thread(cpus[0], &caller_affinity);
+  }
+
+  ~thread_pool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers)
+      worker.join();
+    restore_current_thread(caller_affinity);
+  }
+
+  thread_pool(const thread_pool &) = delete;
+  thread_pool &operator=(const thread_pool &) = delete;
+
+  unsigned size() const { return nthreads; }
+  bool is_pinned() const { return pinned; }
+
+  // Splits [begin,end) into one contiguous band per thread and calls
+  // body(band_begin, band_end, band) for each, returning once all are done.
+  void parallel_for(const unsigned begin, const unsigned end,
+                    const std::function<void(unsigned, unsigned, unsigned)> &body)
+  {
+    if (nthreads == 1 || end - begin < 2) {
+      if (begin < end) body(begin, end, 0);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      job = &body; job_begin = begin; job_end = end;
+      pending = nthreads-1;
+      ++generation;
+    }
+    wake.notify_all();
+    run_band(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pending == 0; });
+    job = nullptr;
+  }
+
+  // The rows [band_begin, band_end) of band t when [begin,end) is split
+  // nthreads ways, as parallel_for() does.
+  static void band_range(const unsigned begin, const unsigned end,
+                         const unsigned t, const unsigned nthreads,
+                         unsigned &band_begin, unsigned &band_end)
+  {
+    const unsigned long long count = end - begin;
+    band_begin = begin + unsigned(count *  t    / nthreads);
+    band_end   = begin + unsigned(count * (t+1) / nthreads);
+  }
+
+private:
+  void run_band(const unsigned t)
+  {
+    unsigned band_begin, band_end;
+    band_range(job_begin, job_end, t, nthreads, band_begin, band_end);
+    if (band_begin < band_end)
+      (*job)(band_begin, band_end, t);
+  }
+
+  void work(const unsigned t, const int cpu)
+  {
+    if (cpu >= 0) pin_current_thread(cpu);
+    unsigned long long seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&] { return stopping || generation != seen; });
+        if (stopping) return;
+        seen = generation;
+      }
+      run_band(t);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0) done.notify_one();
+      }
+    }
+  }
+
+  const unsigned nthreads;
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  const std::function<void(unsigned, unsigned, unsigned)> *job = nullptr;
+  unsigned job_begin = 0, job_end = 0;
+  unsigned long long generation;
+  unsigned pending;
+  bool stopping, pinned;
+  thread_affinity caller_affinity;
+};
+
+#endif // _THREAD_POOL_HPP_
@@ -0,0 +1,77 @@
+#ifndef _TRANSPOSE_HPP_
+#define _TRANSPOSE_HPP_
+
+#include <cstddef>
+#include <cstring>
+#include "row_kernels.hpp"
+
+// Transposes a block of rows x cols elements of SIZE bytes; the strides are
+// in bytes. A constant SIZE turns each memcpy() into a plain move.
+template <std::size_t SIZE>
+void transpose_block(unsigned char *out, const std::size_t out_stride,
+                     const unsigned char *in, const std::size_t in_stride,
+                     const unsigned rows, const unsigned cols)
+{
+  for (unsigned x = 0; x < cols; ++x)
+    for (unsigned y = 0; y < rows; ++y)
+      std::memcpy(out + x*out_stride + y*SIZE, in + y*in_stride + x*SIZE, SIZE);
+}
+
+// The same for elements of a size only known at run time.
+inline void transpose_block(unsigned char *out, const std::size_t out_stride,
+                            const unsigned char *in, const std::size_t in_stride,
+                            const unsigned rows, const unsigned cols,
+                            const std::size_t element_size)
+{
+  for (unsigned x = 0; x < cols; ++x)
+    for (unsigned y = 0; y < rows; ++y)
+      std::memcpy(out + x*out_stride + y*element_size,
+                  in + y*in_stride + x*element_size, element_size);
+}
+
+// Transposes the rows x cols matrix of element_size-byte elements at in
+// into the cols x rows matrix at out: element (y,x) goes to (x,y). The
+// strides are the bytes from one row to the next. The matrix is halved
+// along its longer side until a block of both matrices fits in the L1
+// cache, whatever its size, so neither side is walked a whole column at a
+// time. 4-byte elements, such as 32-bit totals or RGBX pixels, are moved by
+// the vectorised block kernel of the row kernels in use.
+inline void transpose(void *out, const std::size_t out_stride,
+                      const void *in, const std::size_t in_stride,
+                      const unsigned rows, const unsigned cols,
+                      const std::size_t element_size)
+{
+  const unsigned leaf = element_size <= 4 ? 32 : 16;
+  unsigned char *dst = static_cast<unsigned char *>(out);
+  const unsigned char *src = static_cast<const unsigned char *>(in);
+
+  if (rows > leaf && rows >= cols) {
+    const unsigned half = rows / 2;
+    transpose(dst, out_stride, src, in_stride, half, cols, element_size);
+    transpose(dst + half*element_size, out_stride, src + half*in_stride, in_stride,
+              rows - half, cols, element_size);
+    return;
+  }
+  if (cols > leaf) {
+    const unsigned half = cols / 2;
+    transpose(dst, out_stride, src, in_stride, rows, half, element_size);
+    transpose(dst + half*out_stride, out_stride, src + half*element_size, in_stride,
+              rows, cols - half, element_size);
+    return;
+  }
+
+  switch (element_size) {
+    case 1:  transpose_block<1> (dst, out_stride, src, in_stride, rows, cols); break;
+    case 3:  transpose_block<3> (dst, out_stride, src, in_stride, rows, cols); break;
+    case 4:
+      active_row_kernels().transpose_block32(
+        reinterpret_cast<uint32_t *>(dst), out_stride / 4,
+        reinterpret_cast<const uint32_t *>(src), in_stride / 4, rows, cols);
+      break;
+    case 12: transpose_block<12>(dst, out_stride, src, in_stride, rows, cols); break;
+    case 16: transpose_block<16>(dst, out_stride, src, in_stride, rows, cols); break;
+    default: transpose_block(dst, out_stride, src, in_stride, rows, cols, element_size); break;
+  }
+}
+
+#endif // _TRANSPOSE_HPP_
@@ -1,25 +1,329 @@
 #ifndef _UNSHARP_MASK_HPP_
 #define _UNSHARP_MASK_HPP_
 
+#include <functional>
+#include <cstring>
 #include "blur.hpp"
+#include "box_stage.hpp"
+#include "thread_pool.hpp"
+#include "numa.hpp"
+#include "unsharp_workspace.hpp"
+#include "cpu_features.hpp"
 #include "add_weighted.hpp"
 #include "ppm.hpp"
 
+// The blur cascade ping-pongs between out and a single scratch frame from
+// workspace, which is grown to fit: blur1 and blur3 share the scratch frame
+// and blur2 is written into out, which add_weighted() then overwrites
+// pixel by pixel. The sliding blur needs no scratch frame at all, as blur2
+// and blur3 run in place in out. Only in and out are live as full frames,
+// plus at most the one scratch frame, instead of five frames.
 void unsharp_mask(unsigned char *out, const unsigned char *in,
                   const int blur_radius,
-                  const unsigned w, const unsigned h, const unsigned nchannels)
+                  const unsigned w, const unsigned h, const unsigned nchannels,
+                  unsharp_workspace &workspace,
+                  const blur_method method = blur_method::sliding,
+                  const blur_rounding rounding = blur_rounding::truncate,
+                  const blur_border border = blur_border::replicate)
 {
   const auto alpha = 1.5f; const auto beta = -0.5f;
-  std::vector<unsigned char> blur1, blur2, blur3;
+  if (method == blur_method::sliding) {
+    // Only the naive blur implements the other border modes, as in blur().
+    assert(border == blur_border::replicate);
+    blur_sliding(out, in, blur_radius, w, h, nchannels, rounding);
+    blur_in_place(out, blur_radius, w, h, nchannels, rounding);
+    blur_in_place(out, blur_radius, w, h, nchannels, rounding);
+    add_weighted(out, in, alpha, out, beta, 0.0f, w, h, nchannels);
+    return;
+  }
 
-  blur1.resize(w * h * nchannels);
-  blur2.resize(w * h * nchannels);
-  blur3.resize(w * h * nchannels);
+  workspace.reserve(w * h * nchannels, 1);
+  unsigned char *blur1 = workspace.frame(0);
+  unsigned char *blur2 = out;
+  unsigned char *blur3 = workspace.frame(0);
 
-  blur(blur1.data(),   in,           blur_radius, w, h, nchannels);
-  blur(blur2.data(),   blur1.data(), blur_radius, w, h, nchannels);
-  blur(blur3.data(),   blur2.data(), blur_radius, w, h, nchannels);
-  add_weighted(out, in, alpha, blur3.data(), beta, 0.0f, w, h, nchannels);
+  blur(blur1,   in,    blur_radius, w, h, nchannels, method, rounding, border);
+  blur(blur2,   blur1, blur_radius, w, h, nchannels, method, rounding, border);
+  blur(blur3,   blur2, blur_radius, w, h, nchannels, method, rounding, border);
+  add_weighted(out, in, alpha, blur3, beta, 0.0f, w, h, nchannels);
 }
 
+void unsharp_mask(unsigned char *out, const unsigned char *in,
+                  const int blur_radius,
+                  const unsigned w, const unsigned h, const unsigned nchannels,
+                  const blur_method method = blur_method::sliding,
+                  const blur_rounding rounding = blur_rounding::truncate,
+                  const blur_border border = blur_border::replicate)
+{
+  unsharp_workspace workspace;
+  unsharp_mask(out, in, blur_radius, w, h, nchannels, workspace, method, rounding, border);
+}
+
+// Computes the same sharpened image as unsharp_mask() on a planar copy of
+// the input: it is split into one w*h plane per channel on entry, every blur
+// and the weighted add run on single-channel planes, whose rows are
+// contiguous runs of one channel, and the result is interleaved again on
+// exit. The planar input takes one frame of workspace and the blurs
+// ping-pong between a second frame and out, as in unsharp_mask().
+void unsharp_mask_planar(unsigned char *out, const unsigned char *in,
+                         const int blur_radius,
+                         const unsigned w, const unsigned h, const unsigned nchannels,
+                         unsharp_workspace &workspace,
+                         const blur_method method = blur_method::sliding,
+                         const blur_rounding rounding = blur_rounding::truncate,
+                         const blur_border border = blur_border::replicate)
+{
+  const auto alpha = 1.5f; const auto beta = -0.5f;
+  const unsigned plane_size = w * h;
+  workspace.reserve(plane_size * nchannels, 2);
+  unsigned char *planes = workspace.frame(0);
+  unsigned char *blur1  = workspace.frame(1);
+  unsigned char *blur2  = out;
+  unsigned char *blur3  = workspace.frame(1);
+
+  auto blur_planes = [&](unsigned char *dst, const unsigned char *src) {
+    for (unsigned c = 0; c < nchannels; ++c)
+      blur(dst + c*plane_size, src + c*plane_size, blur_radius, w, h, 1, method, rounding, border);
+  };
+
+  active_row_kernels().deinterleave(planes, plane_size, in, plane_size, nchannels);
+  blur_planes(blur1, planes);
+  blur_planes(blur2, blur1);
+  blur_planes(blur3, blur2);
+  // The weighted add is per byte, so the planes are sharpened as they are.
+  add_weighted(blur3, planes, alpha, blur3, beta, 0.0f, w, h, nchannels);
+  active_row_kernels().interleave(out, blur3, plane_size, plane_size, nchannels);
+}
+
+// Sharpens an image that arrives one row at a time from the top, as
+// unsharp_mask() would, handing each finished row to emit(y, row) as soon
+// as the rows below it that its blurs reach have been pushed: row y comes
+// out once row y+3*(blur_radius-1) is in. The three blurs are cascaded
+// box_stage objects and the input rows still needed by the weighted add are
+// kept in a ring of 3*(blur_radius-1)+1 rows, so memory is O(w*blur_radius)
+// whatever the height of the image. The row passed to emit is only valid
+// during the call.
+class unsharp_stream {
+public:
+  typedef std::function<void(unsigned y, const unsigned char *row)> row_sink;
+
+  unsharp_stream(const int blur_radius,
+                 const unsigned w, const unsigned h, const unsigned nchannels,
+                 row_sink emit,
+                 const blur_rounding rounding = blur_rounding::truncate)
+    : w(w), h(h), nchannels(nchannels), row_size(w*nchannels),
+      ring_rows(3*(blur_radius-1)+1 < (int)h ? 3*(blur_radius-1)+1 : h),
+      rows_in(0), rows_out(0), emit(emit),
+      stage1(blur_radius, w, h, nchannels, rounding),
+      stage2(blur_radius, w, h, nchannels, rounding),
+      stage3(blur_radius, w, h, nchannels, rounding),
+      ring(ring_rows*row_size),
+      row1(row_size), row2(row_size), row3(row_size), sharpened(row_size)
+  {
+  }
+
+  // Takes the next input row, emitting every output row that completes.
+  void push_row(const unsigned char *row)
+  {
+    const auto alpha = 1.5f; const auto beta = -0.5f;
+    assert(rows_in < h);
+    std::memcpy(ring_row(rows_in), row, row_size);
+    ++rows_in;
+
+    stage1.push(row);
+    while (stage1.ready()) {
+      stage1.pop(row1.data());
+      stage2.push(row1.data());
+      while (stage2.ready()) {
+        stage2.pop(row2.data());
+        stage3.push(row2.data());
+        while (stage3.ready()) {
+          stage3.pop(row3.data());
+          add_weighted(sharpened.data(), ring_row(rows_out), alpha,
+                       row3.data(), beta, 0.0f, w, 1, nchannels);
+          emit(rows_out++, sharpened.data());
+        }
+      }
+    }
+  }
+
+  unsigned rows_pushed()  const { return rows_in; }
+  unsigned rows_emitted() const { return rows_out; }
+
+  // The memory held by the stream, which does not depend on h.
+  std::size_t bytes_used() const
+  {
+    return stage1.bytes_used() + stage2.bytes_used() + stage3.bytes_used()
+         + ring.size() + 4*row_size;
+  }
+
+private:
+  unsigned char *ring_row(const unsigned y) { return &ring[(y%ring_rows)*row_size]; }
+
+  const unsigned w, h, nchannels, row_size, ring_rows;
+  unsigned rows_in, rows_out;
+  row_sink emit;
+  box_stage stage1, stage2, stage3;
+  std::vector<unsigned char> ring, row1, row2, row3, sharpened;
+};
+
+// Computes the same sharpened image as unsharp_mask() in a single sweep down
+// the image, streaming it through an unsharp_stream. Each row of blur1 is
+// fed to the blur2 stage as soon as it is ready, and likewise into blur3,
+// whose rows are combined with the input by add_weighted() straight away.
+// The intermediates only ever occupy a rolling window of about
+// 2*blur_radius rows per stage, which stays in cache: each input pixel is
+// read from memory once and each output pixel is written once.
+void unsharp_mask_fused(unsigned char *out, const unsigned char *in,
+                        const int blur_radius,
+                        const unsigned w, const unsigned h, const unsigned nchannels,
+                        const blur_rounding rounding = blur_rounding::truncate)
+{
+  const unsigned row_size = w * nchannels;
+  unsharp_stream stream(blur_radius, w, h, nchannels,
+                        [&](unsigned y, const unsigned char *row) {
+                          std::memcpy(out + y*row_size, row, row_size);
+                        }, rounding);
+
+  for (unsigned y = 0; y < h; ++y)
+    stream.push_row(in + y*row_size);
+}
+
+// Computes the same sharpened image as unsharp_mask() on all the threads of
+// pool. Each blur pass and the weighted add are split into one band of rows
+// per thread; a pass starts once the previous one has finished everywhere,
+// since a band's window reaches into its neighbours' rows. The blurs
+// ping-pong between out and one scratch frame of workspace, as in
+// unsharp_mask(). A newly allocated scratch frame is first touched band by
+// band, so each band's rows sit on the NUMA node of the thread that blurs
+// them; in and out are best placed the same way by the caller.
+void unsharp_mask_threaded(unsigned char *out, const unsigned char *in,
+                           const int blur_radius,
+                           const unsigned w, const unsigned h, const unsigned nchannels,
+                           thread_pool &pool, unsharp_workspace &workspace,
+                           const blur_rounding rounding = blur_rounding::truncate)
+{
+  const auto alpha = 1.5f; const auto beta = -0.5f;
+  const unsigned row_size = w * nchannels;
+  if (workspace.reserve(w * h * nchannels, 1))
+    first_touch_rows(pool, workspace.frame(0), h, row_size);
+  unsigned char *blur1 = workspace.frame(0);
+  unsigned char *blur2 = out;
+  unsigned char *blur3 = workspace.frame(0);
+
+  auto blur_pass = [&](unsigned char *dst, const unsigned char *src) {
+    pool.parallel_for(0, h, [&](unsigned y_begin, unsigned y_end, unsigned) {
+      blur_sliding_rows(dst, src, blur_radius, w, h, nchannels, y_begin, y_end, rounding);
+    });
+  };
+  blur_pass(blur1, in);
+  blur_pass(blur2, blur1);
+  blur_pass(blur3, blur2);
+
+  pool.parallel_for(0, h, [&](unsigned y_begin, unsigned y_end, unsigned) {
+    const unsigned offset = y_begin * row_size;
+    add_weighted(out + offset, in + offset, alpha, blur3 + offset, beta, 0.0f,
+                 w, y_end - y_begin, nchannels);
+  });
+}
+
+void unsharp_mask_threaded(unsigned char *out, const unsigned char *in,
+                           const int blur_radius,
+                           const unsigned w, const unsigned h, const unsigned nchannels,
+                           thread_pool &pool,
+                           const blur_rounding rounding = blur_rounding::truncate)
+{
+  unsharp_workspace workspace;
+  unsharp_mask_threaded(out, in, blur_radius, w, h, nchannels, pool, workspace, rounding);
+}
+
+// Picks square tiles whose working set for unsharp_mask_tiled() fits in half
+// of cache_bytes (the L2 size), leaving the rest for the other data in
+// flight. The working set of a tile of side s is its input with a halo of
+// 3*(blur_radius-1) pixels, the three blurred regions with halos of 2, 1
+// and 0 times blur_radius-1, the output tile and the rows of totals.
+void auto_tile_size(const int blur_radius,
+                    const unsigned w, const unsigned h, const unsigned nchannels,
+                    const unsigned long cache_bytes,
+                    unsigned &tile_w, unsigned &tile_h)
+{
+  const unsigned long reach = blur_radius-1;
+  auto footprint = [&](const unsigned long side) {
+    unsigned long bytes = side*side*nchannels;
+    for (unsigned long halo = 0; halo <= 3; ++halo)
+      bytes += (side+2*halo*reach) * (side+2*halo*reach) * nchannels;
+    return bytes + 2*(side+6*reach)*nchannels*sizeof(unsigned);
+  };
+
+  unsigned long side = 16;
+  while (side < w+h && footprint(side+16) <= cache_bytes/2)
+    side += 16;
+  tile_w = side < w ? side : w;
+  tile_h = side < h ? side : h;
+}
+
+// Computes the same sharpened image as unsharp_mask() one tile at a time:
+// blur -> blur -> blur -> add_weighted runs on a tile before moving to the
+// next, each blur on the tile grown by the halo the following stages need,
+// so the intermediate regions stay in cache and never go out to memory.
+// Pixels in the halos are blurred once per tile they border, which costs a
+// little redundant work. A tile_w or tile_h of 0 picks both with
+// auto_tile_size() from the detected L2 size. With a pool, the tiles are
+// shared among its threads.
+void unsharp_mask_tiled(unsigned char *out, const unsigned char *in,
+                        const int blur_radius,
+                        const unsigned w, const unsigned h, const unsigned nchannels,
+                        unsigned tile_w, unsigned tile_h,
+                        thread_pool *pool = nullptr,
+                        const blur_rounding rounding = blur_rounding::truncate)
+{
+  const auto alpha = 1.5f; const auto beta = -0.5f;
+  const int reach = blur_radius-1;
+  if (tile_w == 0 || tile_h == 0)
+    auto_tile_size(blur_radius, w, h, nchannels, detect_cache_sizes().l2, tile_w, tile_h);
+  const unsigned tiles_x = (w + tile_w - 1) / tile_w;
+  const unsigned tiles_y = (h + tile_h - 1) / tile_h;
+
+  // The input is only read.
+  const image_region image = { const_cast<unsigned char *>(in), 0, 0, w, h,
+                               w*nchannels, nchannels };
+
+  auto run_tiles = [&](unsigned t_begin, unsigned t_end, unsigned) {
+    const unsigned span = (tile_w+6*reach < w ? tile_w+6*reach : w) * nchannels;
+    std::vector<unsigned char> blur1, blur2, blur3;
+    std::vector<unsigned> column_totals(span), box_totals(span);
+
+    for (unsigned t = t_begin; t < t_end; ++t) {
+      image_region tile;
+      tile.x0 = (t % tiles_x) * tile_w; tile.x1 = tile.x0 + tile_w < w ? tile.x0 + tile_w : w;
+      tile.y0 = (t / tiles_x) * tile_h; tile.y1 = tile.y0 + tile_h < h ? tile.y0 + tile_h : h;
+      tile.nchannels = nchannels; tile.stride = tile.width()*nchannels;
+
+      image_region region2 = grow_region(tile,    reach, w, h);
+      image_region region1 = grow_region(region2, reach, w, h);
+      blur1.resize(region1.size()); region1.data = blur1.data();
+      blur2.resize(region2.size()); region2.data = blur2.data();
+      blur3.resize(tile.size());    tile.data    = blur3.data();
+
+      blur_region(region1, image,   blur_radius, w, h, column_totals.data(), box_totals.data(), rounding);
+      blur_region(region2, region1, blur_radius, w, h, column_totals.data(), box_totals.data(), rounding);
+      blur_region(tile,    region2, blur_radius, w, h, column_totals.data(), box_totals.data(), rounding);
+
+      for (unsigned y = tile.y0; y < tile.y1; ++y) {
+        const unsigned offset = (y*w + tile.x0) * nchannels;
+        add_weighted(out + offset, in + offset, alpha, tile.pixel(tile.x0, y), beta, 0.0f,
+                     tile.width(), 1, nchannels);
+      }
+    }
+  };
+
+  if (pool)
+    pool->parallel_for(0, tiles_x*tiles_y, run_tiles);
+  else
+    run_tiles(0, tiles_x*tiles_y, 0);
+}
+
+// The execution plans for the whole unsharp mask on the host.
+enum class unsharp_engine { frames, fused, threaded, tiled, planar };
+
 #endif // _UNSHARP_MASK_HPP_
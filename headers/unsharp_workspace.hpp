@@ -0,0 +1,57 @@
+#ifndef _UNSHARP_WORKSPACE_HPP_
+#define _UNSHARP_WORKSPACE_HPP_
+
+#include <cstddef>
+#include <cassert>
+#include "image_buffer.hpp"
+
+// The scratch frames the sharpening engines blur into, owned across calls
+// so that sharpening a batch of images allocates them once rather than per
+// image. The frames only ever grow: a call on an image no larger than any
+// before reuses them as they are, and a frame no engine has asked for is
+// never allocated. They are not zero-filled, as every blur writes all of
+// its output, so fresh pages are not touched until the first blur writes
+// them. The frames are image_buffers, on huge pages where available.
+class unsharp_workspace {
+public:
+  static const unsigned max_frames = 3;
+
+  unsharp_workspace() : allocated(0) {}
+
+  unsharp_workspace(const unsharp_workspace &) = delete;
+  unsharp_workspace &operator=(const unsharp_workspace &) = delete;
+
+  // Makes the first nframes frames at least frame_size bytes long, and
+  // tells whether any had to be allocated afresh.
+  bool reserve(const std::size_t frame_size, const unsigned nframes = max_frames)
+  {
+    assert(nframes <= max_frames);
+    bool grown = false;
+    for (unsigned i = 0; i < nframes; ++i) {
+      if (frame_size <= frames[i].size()) continue;
+      image_buffer().swap(frames[i]); // free the old frame before the new one
+      frames[i].resize(frame_size);
+      allocated += frame_size;
+      grown = true;
+    }
+    return grown;
+  }
+
+  unsigned char *frame(const unsigned i) { return frames[i].data(); }
+
+  // The bytes held now, and the bytes allocated over the workspace's life;
+  // the two differ once a larger image has made the frames grow.
+  std::size_t bytes_held() const
+  {
+    std::size_t total = 0;
+    for (const image_buffer &frame : frames) total += frame.size();
+    return total;
+  }
+  std::size_t bytes_allocated() const { return allocated; }
+
+private:
+  image_buffer frames[max_frames];
+  std::size_t allocated;
+};
+
+#endif // _UNSHARP_WORKSPACE_HPP_
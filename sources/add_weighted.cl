@@ -1,3 +1,11 @@
+// The channels per pixel: a compile-time constant when built with
+// -D NCHANNELS=n, otherwise the kernel's nchannels argument.
+#ifdef NCHANNELS
+#define CHANNELS NCHANNELS
+#else
+#define CHANNELS nchannels
+#endif
+
 //------------------------------------------------------------------------------
 //
 // kernel:  add_weighted  
@@ -26,14 +34,10 @@
 		int x = get_global_id(0);
 		int y = get_global_id(1);
 
-			unsigned byte_offset = (y*w + x)*nchannels;
-
-			float tmp = in1[byte_offset + 0] * alpha + in2[byte_offset + 0] * beta + gamma;
-			out[byte_offset + 0] = tmp < 0 ? 0 : tmp > UCHAR_MAX ? UCHAR_MAX : tmp;
-
-			tmp = in1[byte_offset + 1] * alpha + in2[byte_offset + 1] * beta + gamma;
-			out[byte_offset + 1] = tmp < 0 ? 0 : tmp > UCHAR_MAX ? UCHAR_MAX : tmp;
+			unsigned byte_offset = (y*w + x)*CHANNELS;
 
-			tmp = in1[byte_offset + 2] * alpha + in2[byte_offset + 2] * beta + gamma;
-			out[byte_offset + 2] = tmp < 0 ? 0 : tmp > UCHAR_MAX ? UCHAR_MAX : tmp;
+			for (unsigned c = 0; c < CHANNELS; ++c) {
+				float tmp = in1[byte_offset + c] * alpha + in2[byte_offset + c] * beta + gamma;
+				out[byte_offset + c] = tmp < 0 ? 0 : tmp > UCHAR_MAX ? UCHAR_MAX : tmp;
+			}
 }
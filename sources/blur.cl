@@ -1,3 +1,81 @@
+// The index of channel c of pixel (x,y). Images are interleaved (RGBRGB...)
+// unless the program is built with -D PLANAR_LAYOUT, which stores each
+// channel as a w*h plane of its own so that neighbouring work-items read
+// neighbouring bytes. Every kernel built from this file shares the layout.
+#ifdef PLANAR_LAYOUT
+#define PIXEL_INDEX(x, y, c, w, h, nchannels) (((c)*(h) + (y))*(w) + (x))
+#else
+#define PIXEL_INDEX(x, y, c, w, h, nchannels) (((y)*(w) + (x))*(nchannels) + (c))
+#endif
+
+// The channels per pixel. Built with -D NCHANNELS=n it is a compile-time
+// constant, so the channel loops unroll and the pixel stride folds into the
+// addressing; otherwise the kernels' nchannels argument is used.
+#ifdef NCHANNELS
+#define CHANNELS NCHANNELS
+#else
+#define CHANNELS nchannels
+#endif
+
+// The blur radius. Built with -D BLUR_RADIUS=r the window loops have a
+// constant trip count the compiler unrolls, and divide_total() divides by
+// the constant NSAMPLES; otherwise the kernels' blur_radius argument and
+// the host's reciprocal are used. The host builds one program per radius.
+#ifdef BLUR_RADIUS
+#define RADIUS BLUR_RADIUS
+#define NSAMPLES ((2*BLUR_RADIUS - 1)*(2*BLUR_RADIUS - 1))
+#else
+#define RADIUS blur_radius
+#endif
+
+// How windows are filled past the image edge, as blur_border in
+// headers/blur.hpp, whose values these are. Built with -D BORDER_MODE=n; the
+// default replicates the edge pixel. Only the naive and local kernels read it.
+#define BORDER_REPLICATE 0
+#define BORDER_REFLECT   1
+#define BORDER_WRAP      2
+#define BORDER_CONSTANT  3
+#ifndef BORDER_MODE
+#define BORDER_MODE BORDER_REPLICATE
+#endif
+
+// Maps index i of a row or column of n pixels into [0,n) as BORDER_MODE
+// fills it, or returns -1 where the constant border reads a zero.
+int border_index(int i, const int n)
+{
+	if (i >= 0 && i < n) return i;
+#if BORDER_MODE == BORDER_REFLECT
+	if (n == 1) return 0;
+	const int period = 2*(n - 1);
+	i %= period;
+	if (i < 0) i += period;
+	return i < n ? i : period - i;
+#elif BORDER_MODE == BORDER_WRAP
+	i %= n;
+	return i < 0 ? i + n : i;
+#elif BORDER_MODE == BORDER_CONSTANT
+	return -1;
+#else
+	return i < 0 ? 0 : n - 1;
+#endif
+}
+
+// Divides a window total by nsamples as ((total + bias) * multiplier) >> shift.
+// The host computes the three values with box_divisor in headers/blur.hpp, which
+// makes this exactly floor((total + bias) / nsamples), bit-identical to the host.
+unsigned char divide_total(
+	const unsigned int total,
+	const ulong multiplier,
+	const unsigned bias,
+	const unsigned shift)
+{
+#ifdef NSAMPLES
+	return (unsigned char)((total + bias) / NSAMPLES);
+#else
+	return (unsigned char)(((ulong)(total + bias) * multiplier) >> shift);
+#endif
+}
+
 //------------------------------------------------------------------------------
 //
 // kernel:  blur  
@@ -7,11 +85,11 @@
 // input: out - the blurred image, in - the original image
 // x - the x index of the current pixel, y - the y index of the current pixel, blur_radius - the range in pixels to be blurred
 // w - the width of the image, h - the height of the image and nchannels the number of pixel channels.
+// multiplier, bias & shift - the precomputed reciprocal of nsamples, see divide_total.
 //
 // output: The average of the nsamples pixels within a blur radius (x,y). Pixels which
-// would be outside the image, replicate the value at the image border.
-// Averages the nsamples pixels within blur_radius of (x,y). Pixels which
-// would be outside the image, replicate the value at the image border.
+// would be outside the image are filled as BORDER_MODE says.
+// The host runs it on the border strips only, and blur_interior on the rest.
 
 void pixel_average(
 	__global unsigned char *out,
@@ -21,26 +99,25 @@ void pixel_average(
 	const int blur_radius,
 	const unsigned w,
 	const unsigned h,
-	const unsigned nchannels)
+	const unsigned nchannels,
+	const ulong multiplier,
+	const unsigned bias,
+	const unsigned shift)
 {
-		float red_total = 0, green_total = 0, blue_total = 0;
-
-		for (int j = y - blur_radius + 1; j < y + blur_radius; ++j) {
-			for (int i = x - blur_radius + 1; i < x + blur_radius; ++i) {
-				const unsigned r_i = i < 0 ? 0 : i >= w ? w - 1 : i;
+	for (unsigned c = 0; c < CHANNELS; ++c) {
+		unsigned int total = 0;
 
-				const unsigned r_j = j < 0 ? 0 : j >= h ? h - 1 : j;
-				unsigned byte_offset = (r_j*w + r_i)*nchannels;
-				red_total += in[byte_offset + 0];
-				green_total += in[byte_offset + 1];
-				blue_total += in[byte_offset + 2];
+		for (int j = y - RADIUS + 1; j < y + RADIUS; ++j) {
+			const int r_j = border_index(j, h);
+			if (r_j < 0) continue;
+			for (int i = x - RADIUS + 1; i < x + RADIUS; ++i) {
+				const int r_i = border_index(i, w);
+				if (r_i < 0) continue;
+				total += in[PIXEL_INDEX(r_i, r_j, c, w, h, CHANNELS)];
 			}
 		}
-	const unsigned nsamples = (blur_radius * 2 - 1) * (blur_radius * 2 - 1);
-	unsigned byte_offset = (y*w + x)*nchannels;
-	out[byte_offset + 0] = red_total / nsamples;
-	out[byte_offset + 1] = green_total / nsamples;
-	out[byte_offset + 2] = blue_total / nsamples;
+		out[PIXEL_INDEX(x, y, c, w, h, CHANNELS)] = divide_total(total, multiplier, bias, shift);
+	}
 }
 
 __kernel void blur(
@@ -49,10 +126,269 @@ __kernel void blur(
 	const int blur_radius,
 	const unsigned w,
 	const unsigned h,
-	const unsigned nchannels)
+	const unsigned nchannels,
+	const ulong multiplier,
+	const unsigned bias,
+	const unsigned shift)
 {
 		int x = get_global_id(0);
 		int y = get_global_id(1);
 		//barrier(CLK_GLOBAL_MEM_FENCE);
-		pixel_average(out, in, x, y, blur_radius, w, h, nchannels);
+		pixel_average(out, in, x, y, blur_radius, w, h, nchannels, multiplier, bias, shift);
+}
+
+//------------------------------------------------------------------------------
+//
+// kernel:  blur_interior  
+//
+// Purpose: The blur kernel without border handling
+// 
+// input: as blur, launched with a global offset over the pixels whose window lies
+// wholly inside the image: [blur_radius-1, w-blur_radius] x [blur_radius-1, h-blur_radius].
+//
+// output: The same average as blur, with no index clamped or checked.
+
+__kernel void blur_interior(
+	__global unsigned char* out,
+	__global const unsigned char* in,
+	const int blur_radius,
+	const unsigned w,
+	const unsigned h,
+	const unsigned nchannels,
+	const ulong multiplier,
+	const unsigned bias,
+	const unsigned shift)
+{
+		int x = get_global_id(0);
+		int y = get_global_id(1);
+
+		for (unsigned c = 0; c < CHANNELS; ++c) {
+			unsigned int total = 0;
+			for (int j = y - RADIUS + 1; j < y + RADIUS; ++j)
+				for (int i = x - RADIUS + 1; i < x + RADIUS; ++i)
+					total += in[PIXEL_INDEX(i, j, c, w, h, CHANNELS)];
+			out[PIXEL_INDEX(x, y, c, w, h, CHANNELS)] = divide_total(total, multiplier, bias, shift);
+		}
+}
+
+//------------------------------------------------------------------------------
+//
+// kernel:  blur_local  
+//
+// Purpose: The blur kernel, computed from a tile of the image held in local memory
+// 
+// input: as blur, plus tile - local memory for the work-group's pixels and a halo of
+// blur_radius-1 pixels on every side: (get_local_size(0)+2*(blur_radius-1)) x
+// (get_local_size(1)+2*(blur_radius-1)) pixels of CHANNELS bytes. The global size is
+// rounded up to whole work-groups; work-items past the image only help load the tile.
+//
+// output: The same average as blur. The work-group loads its tile from global memory once,
+// filling the halo past the image edge as BORDER_MODE says, and every window is then
+// summed from local memory, so each input byte is fetched once per work-group rather
+// than once per window it falls in.
+
+__kernel void blur_local(
+	__global unsigned char* out,
+	__global const unsigned char* in,
+	const int blur_radius,
+	const unsigned w,
+	const unsigned h,
+	const unsigned nchannels,
+	const ulong multiplier,
+	const unsigned bias,
+	const unsigned shift,
+	__local unsigned char* tile)
+{
+		const int reach = RADIUS - 1;
+		const int lw = get_local_size(0), lh = get_local_size(1);
+		const int lx = get_local_id(0), ly = get_local_id(1);
+		const int tile_w = lw + 2*reach, tile_h = lh + 2*reach;
+		const int x0 = get_group_id(0)*lw - reach, y0 = get_group_id(1)*lh - reach;
+
+		// The work-items load the tile together, each every lw-th pixel of every lh-th row.
+		for (int ty = ly; ty < tile_h; ty += lh) {
+			const int r_j = border_index(y0 + ty, h);
+			for (int tx = lx; tx < tile_w; tx += lw) {
+				const int r_i = border_index(x0 + tx, w);
+				for (unsigned c = 0; c < CHANNELS; ++c)
+					tile[(ty*tile_w + tx)*CHANNELS + c] =
+						r_j < 0 || r_i < 0 ? 0 : in[PIXEL_INDEX(r_i, r_j, c, w, h, CHANNELS)];
+			}
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		const int x = get_global_id(0);
+		const int y = get_global_id(1);
+		if (x >= w || y >= h) return;
+
+		for (unsigned c = 0; c < CHANNELS; ++c) {
+			unsigned int total = 0;
+			for (int j = 0; j < 2*RADIUS - 1; ++j)
+				for (int i = 0; i < 2*RADIUS - 1; ++i)
+					total += tile[((ly + j)*tile_w + lx + i)*CHANNELS + c];
+			out[PIXEL_INDEX(x, y, c, w, h, CHANNELS)] = divide_total(total, multiplier, bias, shift);
+		}
+}
+
+//------------------------------------------------------------------------------
+//
+// kernel:  blur_horizontal  
+//
+// Purpose: First pass of the separable blur
+// 
+// input: out - the row totals, in - the original image, blur_radius - the range in pixels to be blurred
+// w - the width of the image, h - the height of the image and nchannels the number of pixel channels.
+//
+// output: The sum of the 2*blur_radius-1 pixels on the same row as (x,y), per channel.
+// Pixels which would be outside the image, replicate the value at the image border.
+
+__kernel void blur_horizontal(
+	__global unsigned int* out,
+	__global const unsigned char* in,
+	const int blur_radius,
+	const unsigned w,
+	const unsigned h,
+	const unsigned nchannels)
+{
+		int x = get_global_id(0);
+		int y = get_global_id(1);
+
+		for (unsigned c = 0; c < CHANNELS; ++c) {
+			unsigned int total = 0;
+			for (int i = x - RADIUS + 1; i < x + RADIUS; ++i) {
+				const unsigned r_i = i < 0 ? 0 : i >= w ? w - 1 : i;
+				total += in[PIXEL_INDEX(r_i, y, c, w, h, CHANNELS)];
+			}
+			out[PIXEL_INDEX(x, y, c, w, h, CHANNELS)] = total;
+		}
+}
+
+//------------------------------------------------------------------------------
+//
+// kernel:  blur_vertical  
+//
+// Purpose: Second pass of the separable blur
+// 
+// input: out - the blurred image, in - the row totals from blur_horizontal, blur_radius - the range in pixels to be blurred
+// w - the width of the image, h - the height of the image and nchannels the number of pixel channels.
+// multiplier, bias & shift - the precomputed reciprocal of nsamples, see divide_total.
+//
+// output: Sums the 2*blur_radius-1 row totals in the same column as (x,y) and divides by nsamples,
+// giving the same average as blur. Rows which would be outside the image, replicate the border row.
+
+__kernel void blur_vertical(
+	__global unsigned char* out,
+	__global const unsigned int* in,
+	const int blur_radius,
+	const unsigned w,
+	const unsigned h,
+	const unsigned nchannels,
+	const ulong multiplier,
+	const unsigned bias,
+	const unsigned shift)
+{
+		int x = get_global_id(0);
+		int y = get_global_id(1);
+
+		for (unsigned c = 0; c < CHANNELS; ++c) {
+			unsigned int total = 0;
+			for (int j = y - RADIUS + 1; j < y + RADIUS; ++j) {
+				const unsigned r_j = j < 0 ? 0 : j >= h ? h - 1 : j;
+				total += in[PIXEL_INDEX(x, r_j, c, w, h, CHANNELS)];
+			}
+			out[PIXEL_INDEX(x, y, c, w, h, CHANNELS)] = divide_total(total, multiplier, bias, shift);
+		}
+}
+
+//------------------------------------------------------------------------------
+//
+// kernel:  blur_rows  
+//
+// Purpose: First pass of the sliding separable blur, one work-item per strip of a row
+// 
+// input: out - the row totals, in - the original image, blur_radius - the range in pixels to be blurred
+// w - the width of the image, h - the height of the image and nchannels the number of pixel channels.
+// strip - the pixels of a row each work-item covers; work-item (s,y) covers [s*strip, (s+1)*strip) of row y.
+//
+// output: The same row totals as blur_horizontal. Only the first window of the strip is summed
+// in full; each later one adds the pixel entering it and subtracts the one leaving it, so a
+// total costs two reads whatever the radius. Pixels outside the image replicate the border.
+
+__kernel void blur_rows(
+	__global unsigned int* out,
+	__global const unsigned char* in,
+	const int blur_radius,
+	const unsigned w,
+	const unsigned h,
+	const unsigned nchannels,
+	const unsigned strip)
+{
+		int x0 = get_global_id(0) * strip;
+		int y = get_global_id(1);
+		int x1 = x0 + strip < w ? x0 + strip : w;
+
+		for (unsigned c = 0; c < CHANNELS; ++c) {
+			unsigned int total = 0;
+			for (int i = x0 - RADIUS + 1; i < x0 + RADIUS; ++i) {
+				const unsigned r_i = i < 0 ? 0 : i >= w ? w - 1 : i;
+				total += in[PIXEL_INDEX(r_i, y, c, w, h, CHANNELS)];
+			}
+			out[PIXEL_INDEX(x0, y, c, w, h, CHANNELS)] = total;
+
+			for (int x = x0 + 1; x < x1; ++x) {
+				const unsigned entering = x + RADIUS - 1 >= w ? w - 1 : x + RADIUS - 1;
+				const unsigned leaving = x - RADIUS < 0 ? 0 : x - RADIUS;
+				total += in[PIXEL_INDEX(entering, y, c, w, h, CHANNELS)];
+				total -= in[PIXEL_INDEX(leaving, y, c, w, h, CHANNELS)];
+				out[PIXEL_INDEX(x, y, c, w, h, CHANNELS)] = total;
+			}
+		}
+}
+
+//------------------------------------------------------------------------------
+//
+// kernel:  blur_cols  
+//
+// Purpose: Second pass of the sliding separable blur, one work-item per strip of a column
+// 
+// input: out - the blurred image, in - the row totals from blur_rows, blur_radius - the range in pixels to be blurred
+// w - the width of the image, h - the height of the image and nchannels the number of pixel channels.
+// multiplier, bias & shift - the precomputed reciprocal of nsamples, see divide_total.
+// strip - the rows of a column each work-item covers; work-item (x,s) covers [s*strip, (s+1)*strip) of column x.
+//
+// output: The same average as blur. The column total slides down the strip as blur_rows slides
+// along a row, and neighbouring work-items read neighbouring columns of each row.
+
+__kernel void blur_cols(
+	__global unsigned char* out,
+	__global const unsigned int* in,
+	const int blur_radius,
+	const unsigned w,
+	const unsigned h,
+	const unsigned nchannels,
+	const ulong multiplier,
+	const unsigned bias,
+	const unsigned shift,
+	const unsigned strip)
+{
+		int x = get_global_id(0);
+		int y0 = get_global_id(1) * strip;
+		int y1 = y0 + strip < h ? y0 + strip : h;
+
+		for (unsigned c = 0; c < CHANNELS; ++c) {
+			unsigned int total = 0;
+			for (int j = y0 - RADIUS + 1; j < y0 + RADIUS; ++j) {
+				const unsigned r_j = j < 0 ? 0 : j >= h ? h - 1 : j;
+				total += in[PIXEL_INDEX(x, r_j, c, w, h, CHANNELS)];
+			}
+			out[PIXEL_INDEX(x, y0, c, w, h, CHANNELS)] = divide_total(total, multiplier, bias, shift);
+
+			for (int y = y0 + 1; y < y1; ++y) {
+				const unsigned entering = y + RADIUS - 1 >= h ? h - 1 : y + RADIUS - 1;
+				const unsigned leaving = y - RADIUS < 0 ? 0 : y - RADIUS;
+				total += in[PIXEL_INDEX(x, entering, c, w, h, CHANNELS)];
+				total -= in[PIXEL_INDEX(x, leaving, c, w, h, CHANNELS)];
+				out[PIXEL_INDEX(x, y, c, w, h, CHANNELS)] = divide_total(total, multiplier, bias, shift);
+			}
+		}
 }
@@ -0,0 +1,116 @@
+// Built after sources/blur.cl, whose RADIUS, CHANNELS, PIXEL_INDEX() and
+// divide_total() the kernel shares.
+
+// One box pass in local memory. Each work-item of the group blurs its share
+// of the region reaching out_halo pixels around the group's block at
+// (x0,y0), from the region reaching in_halo pixels around it, into out.
+// Windows are clamped to the image, replicating the border as each launch of
+// blur does, so only the part of a region inside the image is read or written.
+void box_pass_local(
+	__local unsigned char* out,
+	const int out_halo,
+	__local const unsigned char* in,
+	const int in_halo,
+	const int x0,
+	const int y0,
+	const int blur_radius,
+	const unsigned w,
+	const unsigned h,
+	const unsigned nchannels,
+	const ulong multiplier,
+	const unsigned bias,
+	const unsigned shift)
+{
+		const int lw = get_local_size(0), lh = get_local_size(1);
+		const int out_w = lw + 2*out_halo, out_h = lh + 2*out_halo;
+		const int in_w = lw + 2*in_halo;
+
+		for (int p = get_local_id(1)*lw + get_local_id(0); p < out_w*out_h; p += lw*lh) {
+			const int x = x0 - out_halo + p % out_w;
+			const int y = y0 - out_halo + p / out_w;
+			if (x < 0 || x >= w || y < 0 || y >= h) continue;
+
+			for (unsigned c = 0; c < CHANNELS; ++c) {
+				unsigned int total = 0;
+				for (int j = y - RADIUS + 1; j < y + RADIUS; ++j) {
+					const int t_j = clamp(j, 0, (int)h - 1) - (y0 - in_halo);
+					for (int i = x - RADIUS + 1; i < x + RADIUS; ++i)
+						total += in[(t_j*in_w + clamp(i, 0, (int)w - 1) - (x0 - in_halo))*CHANNELS + c];
+				}
+				out[p*CHANNELS + c] = divide_total(total, multiplier, bias, shift);
+			}
+		}
+}
+
+//------------------------------------------------------------------------------
+//
+// kernel:  unsharp_local
+//
+// Purpose: The whole unsharp mask, three blurs and add_weighted, in one launch
+//
+// input: out - the sharpened image, in - the original image, blur_radius - the range in pixels to be blurred
+// w - the width of the image, h - the height of the image and nchannels the number of pixel channels.
+// multiplier, bias & shift - the precomputed reciprocal of nsamples, see divide_total.
+// alpha, beta & gamma - weighting values for the unsharpening calculation, see add_weighted.
+// tile - local memory for the original's pixels 3*(blur_radius-1) around the work-group's block,
+// (get_local_size(0)+6*(blur_radius-1)) x (get_local_size(1)+6*(blur_radius-1)) pixels of CHANNELS bytes.
+// blurred - local memory for the first blur 2*(blur_radius-1) around the block, likewise sized.
+// The global size is rounded up to whole work-groups.
+//
+// output: The same pixels as three launches of blur with the replicated border followed by
+// add_weighted. The group reads its block and halo of the original once; the first blur goes
+// to blurred, the second back over tile, and the third is added straight to the original, so
+// the intermediate images never reach global memory.
+
+__kernel void unsharp_local(
+	__global unsigned char* out,
+	__global const unsigned char* in,
+	const int blur_radius,
+	const unsigned w,
+	const unsigned h,
+	const unsigned nchannels,
+	const ulong multiplier,
+	const unsigned bias,
+	const unsigned shift,
+	const float alpha,
+	const float beta,
+	const float gamma,
+	__local unsigned char* tile,
+	__local unsigned char* blurred)
+{
+		const int reach = RADIUS - 1;
+		const int lw = get_local_size(0), lh = get_local_size(1);
+		const int x0 = get_group_id(0)*lw, y0 = get_group_id(1)*lh;
+
+		// The work-items load the part of the block and its halo inside the image together.
+		const int tile_w = lw + 6*reach, tile_h = lh + 6*reach;
+		for (int p = get_local_id(1)*lw + get_local_id(0); p < tile_w*tile_h; p += lw*lh) {
+			const int x = x0 - 3*reach + p % tile_w;
+			const int y = y0 - 3*reach + p / tile_w;
+			if (x < 0 || x >= w || y < 0 || y >= h) continue;
+			for (unsigned c = 0; c < CHANNELS; ++c)
+				tile[p*CHANNELS + c] = in[PIXEL_INDEX(x, y, c, w, h, CHANNELS)];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+		box_pass_local(blurred, 2*reach, tile, 3*reach, x0, y0, blur_radius, w, h, nchannels, multiplier, bias, shift);
+		barrier(CLK_LOCAL_MEM_FENCE);
+		box_pass_local(tile, reach, blurred, 2*reach, x0, y0, blur_radius, w, h, nchannels, multiplier, bias, shift);
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		const int x = get_global_id(0);
+		const int y = get_global_id(1);
+		if (x >= w || y >= h) return;
+
+		const int blurred_w = lw + 2*reach;
+		for (unsigned c = 0; c < CHANNELS; ++c) {
+			unsigned int total = 0;
+			for (int j = y - RADIUS + 1; j < y + RADIUS; ++j) {
+				const int t_j = clamp(j, 0, (int)h - 1) - (y0 - reach);
+				for (int i = x - RADIUS + 1; i < x + RADIUS; ++i)
+					total += tile[(t_j*blurred_w + clamp(i, 0, (int)w - 1) - (x0 - reach))*CHANNELS + c];
+			}
+			const unsigned char blur = divide_total(total, multiplier, bias, shift);
+			float tmp = in[PIXEL_INDEX(x, y, c, w, h, CHANNELS)] * alpha + blur * beta + gamma;
+			out[PIXEL_INDEX(x, y, c, w, h, CHANNELS)] = tmp < 0 ? 0 : tmp > UCHAR_MAX ? UCHAR_MAX : tmp;
+		}
+}
@@ -0,0 +1,109 @@
+// Built after sources/blur.cl and sources/rgbx.cl, whose CHANNELS, PIXEL_INDEX()
+// and divide_total4() the kernels share. The images are CL_RGBA / CL_UNORM_INT8:
+// one texel per pixel, its channels read back as value/255. Pixels of fewer than
+// four channels leave the rest of the texel zero.
+
+// Samples texels by integer coordinates. Coordinates past the image read the
+// nearest edge texel, the replicated border of the buffer kernels, without a
+// clamp in the kernel.
+__constant sampler_t clamp_to_edge = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+
+// The 8-bit channel values of texel (x,y). Rounding value/255 * 255 to the
+// nearest integer gives value back exactly.
+uint4 read_texel(__read_only image2d_t image, const int x, const int y)
+{
+	return convert_uint4_rte(read_imagef(image, clamp_to_edge, (int2)(x, y)) * 255.0f);
+}
+
+//------------------------------------------------------------------------------
+//
+// kernel:  pixels_to_image
+//
+// Purpose: Copies an interleaved image into an RGBA image for blur_image
+//
+// input: out - the RGBA image, in - the interleaved image
+// w - the width of the image, h - the height of the image and nchannels the number of pixel channels.
+//
+// output: Channel c of pixel (x,y) becomes channel c of texel (x,y).
+
+__kernel void pixels_to_image(
+	__write_only image2d_t out,
+	__global const unsigned char* in,
+	const unsigned w,
+	const unsigned h,
+	const unsigned nchannels)
+{
+		int x = get_global_id(0);
+		int y = get_global_id(1);
+
+		uchar4 pixel = (uchar4)(0);
+		pixel.x = in[PIXEL_INDEX(x, y, 0, w, h, CHANNELS)];
+		if (CHANNELS > 1) pixel.y = in[PIXEL_INDEX(x, y, 1, w, h, CHANNELS)];
+		if (CHANNELS > 2) pixel.z = in[PIXEL_INDEX(x, y, 2, w, h, CHANNELS)];
+		if (CHANNELS > 3) pixel.w = in[PIXEL_INDEX(x, y, 3, w, h, CHANNELS)];
+		write_imagef(out, (int2)(x, y), convert_float4(pixel) / 255.0f);
+}
+
+//------------------------------------------------------------------------------
+//
+// kernel:  blur_image
+//
+// Purpose: The blur kernel on RGBA images, read through the image cache
+//
+// input: out - the blurred image, in - the image to blur, blur_radius - the range in pixels to be blurred
+// multiplier, bias & shift - the precomputed reciprocal of nsamples, see divide_total.
+//
+// output: The same average as blur with the replicated border, every channel of a texel at
+// once. The sampler clamps the window to the image, so no index is clamped here.
+
+__kernel void blur_image(
+	__write_only image2d_t out,
+	__read_only image2d_t in,
+	const int blur_radius,
+	const ulong multiplier,
+	const unsigned bias,
+	const unsigned shift)
+{
+		int x = get_global_id(0);
+		int y = get_global_id(1);
+
+		uint4 total = (uint4)(0);
+		for (int j = y - RADIUS + 1; j < y + RADIUS; ++j)
+			for (int i = x - RADIUS + 1; i < x + RADIUS; ++i)
+				total += read_texel(in, i, j);
+		write_imagef(out, (int2)(x, y), convert_float4(divide_total4(total, multiplier, bias, shift)) / 255.0f);
+}
+
+//------------------------------------------------------------------------------
+//
+// kernel:  add_weighted_image
+//
+// Purpose: add_weighted with the blurred image read from an RGBA image
+//
+// input: out - the sharpened image, in1 - the original image, in2 - the blurred RGBA image.
+// alpha, beta & gamma - weighting values for the unsharpening calculation.
+// w - the width of the image, h - the height of the image and nchannels the number of pixel channels.
+//
+// output: out(I) = saturate(in1(I)*alpha + in2(I)*beta + gamma), as add_weighted.
+
+__kernel void add_weighted_image(
+	__global unsigned char *out,
+	__global const unsigned char *in1,
+	const float alpha,
+	__read_only image2d_t in2,
+	const float beta,
+	const float gamma,
+	const unsigned w,
+	const unsigned h,
+	const unsigned nchannels)
+{
+		int x = get_global_id(0);
+		int y = get_global_id(1);
+
+		const uint4 texel = read_texel(in2, x, y);
+		const unsigned blurred[4] = { texel.x, texel.y, texel.z, texel.w };
+		for (unsigned c = 0; c < CHANNELS; ++c) {
+			float tmp = in1[PIXEL_INDEX(x, y, c, w, h, CHANNELS)] * alpha + blurred[c] * beta + gamma;
+			out[PIXEL_INDEX(x, y, c, w, h, CHANNELS)] = tmp < 0 ? 0 : tmp > UCHAR_MAX ? UCHAR_MAX : tmp;
+		}
+}
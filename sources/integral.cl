@@ -0,0 +1,130 @@
+// Built after sources/blur.cl, whose CHANNELS, PIXEL_INDEX() and divide_total() the kernels share.
+
+//------------------------------------------------------------------------------
+//
+// kernel:  integral_rows  
+//
+// Purpose: First half of the summed-area table prefix scan, one work-item per row and channel
+// 
+// input: sat - the summed-area tables, one (w+1)*(h+1) table per channel, in - the original image
+// w - the width of the image, h - the height of the image and nchannels the number of pixel channels.
+//
+// output: Row y+1 of the table holds the running total along row y of the image.
+// The zero first row and column of the table are written here too.
+
+__kernel void integral_rows(
+	__global unsigned int* sat,
+	__global const unsigned char* in,
+	const unsigned w,
+	const unsigned h,
+	const unsigned nchannels)
+{
+		int y = get_global_id(0);
+		int c = get_global_id(1);
+		__global unsigned int* table = sat + c*(w + 1)*(h + 1);
+
+		if (y == 0)
+			for (unsigned x = 0; x <= w; ++x)
+				table[x] = 0;
+
+		unsigned int row_total = 0;
+		table[(y + 1)*(w + 1)] = 0;
+		for (unsigned x = 0; x < w; ++x) {
+			row_total += in[PIXEL_INDEX(x, y, c, w, h, CHANNELS)];
+			table[(y + 1)*(w + 1) + x + 1] = row_total;
+		}
+}
+
+//------------------------------------------------------------------------------
+//
+// kernel:  integral_columns  
+//
+// Purpose: Second half of the summed-area table prefix scan, one work-item per column and channel
+// 
+// input: sat - the row totals from integral_rows
+// w - the width of the image, h - the height of the image and nchannels the number of pixel channels.
+//
+// output: Accumulates each column of row totals downwards, completing the table.
+// Neighbouring work-items walk neighbouring columns, so the loads coalesce.
+
+__kernel void integral_columns(
+	__global unsigned int* sat,
+	const unsigned w,
+	const unsigned h,
+	const unsigned nchannels)
+{
+		int x = get_global_id(0) + 1;
+		int c = get_global_id(1);
+		__global unsigned int* table = sat + c*(w + 1)*(h + 1);
+
+		unsigned int total = 0;
+		for (unsigned y = 1; y <= h; ++y) {
+			total += table[y*(w + 1) + x];
+			table[y*(w + 1) + x] = total;
+		}
+}
+
+// Total of one channel's table over the pixels in [x0,x1) x [y0,y1).
+// Entries may have wrapped; the modular difference is still exact.
+unsigned int rect_total(
+	__global const unsigned int* table,
+	const unsigned x0, const unsigned y0,
+	const unsigned x1, const unsigned y1,
+	const unsigned w)
+{
+	return table[y1*(w + 1) + x1] - table[y0*(w + 1) + x1]
+		- table[y1*(w + 1) + x0] + table[y0*(w + 1) + x0];
+}
+
+//------------------------------------------------------------------------------
+//
+// kernel:  blur_integral  
+//
+// Purpose: Box blur from the summed-area tables in four lookups per channel
+// 
+// input: out - the blurred image, sat - the tables from integral_columns, blur_radius - the range in pixels to be blurred
+// w - the width of the image, h - the height of the image and nchannels the number of pixel channels.
+// multiplier, bias & shift - the precomputed reciprocal of nsamples, see divide_total.
+//
+// output: The same average as blur. Where the window leaves the image, the border row,
+// column and corner are added in again with their repeat counts, replicating the border.
+
+__kernel void blur_integral(
+	__global unsigned char* out,
+	__global const unsigned int* sat,
+	const int blur_radius,
+	const unsigned w,
+	const unsigned h,
+	const unsigned nchannels,
+	const ulong multiplier,
+	const unsigned bias,
+	const unsigned shift)
+{
+		int x = get_global_id(0);
+		int y = get_global_id(1);
+
+		const int x0 = x - blur_radius + 1, x1 = x + blur_radius - 1;
+		const int y0 = y - blur_radius + 1, y1 = y + blur_radius - 1;
+
+		// The left border, the part inside the image and the right border; likewise for rows.
+		const unsigned xbegin[3]  = { 0, x0 < 0 ? 0 : x0, w - 1 };
+		const unsigned xend[3]    = { 1, x1 >= w ? w : x1 + 1, w };
+		const unsigned xweight[3] = { x0 < 0 ? -x0 : 0, 1, x1 >= w ? x1 - w + 1 : 0 };
+		const unsigned ybegin[3]  = { 0, y0 < 0 ? 0 : y0, h - 1 };
+		const unsigned yend[3]    = { 1, y1 >= h ? h : y1 + 1, h };
+		const unsigned yweight[3] = { y0 < 0 ? -y0 : 0, 1, y1 >= h ? y1 - h + 1 : 0 };
+
+		for (unsigned c = 0; c < CHANNELS; ++c) {
+			__global const unsigned int* table = sat + c*(w + 1)*(h + 1);
+			unsigned int total = 0;
+			for (int j = 0; j < 3; ++j) {
+				if (yweight[j] == 0) continue;
+				for (int i = 0; i < 3; ++i) {
+					if (xweight[i] == 0) continue;
+					total += xweight[i] * yweight[j]
+						* rect_total(table, xbegin[i], ybegin[j], xend[i], yend[j], w);
+				}
+			}
+			out[PIXEL_INDEX(x, y, c, w, h, CHANNELS)] = divide_total(total, multiplier, bias, shift);
+		}
+}
@@ -0,0 +1,96 @@
+//------------------------------------------------------------------------------
+//
+// kernel:  deinterleave  
+//
+// Purpose: Converts an interleaved image to the planar layout of blur.cl built with -D PLANAR_LAYOUT
+// 
+// input: planes - the planar image, in - the interleaved image
+// w - the width of the image, h - the height of the image and nchannels the number of pixel channels.
+//
+// output: Channel c of pixel (x,y) is copied to byte (c*h + y)*w + x of planes.
+
+__kernel void deinterleave(
+	__global unsigned char* planes,
+	__global const unsigned char* in,
+	const unsigned w,
+	const unsigned h,
+	const unsigned nchannels)
+{
+		int x = get_global_id(0);
+		int y = get_global_id(1);
+
+		for (unsigned c = 0; c < nchannels; ++c)
+			planes[(c*h + y)*w + x] = in[(y*w + x)*nchannels + c];
+}
+
+//------------------------------------------------------------------------------
+//
+// kernel:  interleave  
+//
+// Purpose: Converts a planar image back to the interleaved layout, the inverse of deinterleave
+// 
+// input: out - the interleaved image, planes - the planar image
+// w - the width of the image, h - the height of the image and nchannels the number of pixel channels.
+//
+// output: Byte (c*h + y)*w + x of planes is copied to channel c of pixel (x,y).
+
+__kernel void interleave(
+	__global unsigned char* out,
+	__global const unsigned char* planes,
+	const unsigned w,
+	const unsigned h,
+	const unsigned nchannels)
+{
+		int x = get_global_id(0);
+		int y = get_global_id(1);
+
+		for (unsigned c = 0; c < nchannels; ++c)
+			out[(y*w + x)*nchannels + c] = planes[(c*h + y)*w + x];
+}
+
+//------------------------------------------------------------------------------
+//
+// kernel:  pad_rgbx  
+//
+// Purpose: Widens an RGB image to the 4-byte RGBX pixels of the kernels in rgbx.cl
+// 
+// input: out - the RGBX image, in - the RGB image
+// w - the width of the image, h - the height of the image.
+//
+// output: Pixel (x,y) is copied with a zero X byte, so every pixel is one aligned uchar4.
+
+__kernel void pad_rgbx(
+	__global uchar4* out,
+	__global const unsigned char* in,
+	const unsigned w,
+	const unsigned h)
+{
+		int x = get_global_id(0);
+		int y = get_global_id(1);
+
+		const uchar3 rgb = vload3(y*w + x, in);
+		out[y*w + x] = (uchar4)(rgb, 0);
+}
+
+//------------------------------------------------------------------------------
+//
+// kernel:  unpad_rgbx  
+//
+// Purpose: Narrows an RGBX image back to RGB, the inverse of pad_rgbx
+// 
+// input: out - the RGB image, in - the RGBX image
+// w - the width of the image, h - the height of the image.
+//
+// output: Pixel (x,y) is copied without its X byte.
+
+__kernel void unpad_rgbx(
+	__global unsigned char* out,
+	__global const uchar4* in,
+	const unsigned w,
+	const unsigned h)
+{
+		int x = get_global_id(0);
+		int y = get_global_id(1);
+
+		vstore3(in[y*w + x].xyz, y*w + x, out);
+}
@@ -0,0 +1,182 @@
+// Built after sources/blur.cl, whose divide_total() the kernels share. Every
+// pixel is one uchar4 (see pad_rgbx in layout.cl), so each load and store
+// is a single aligned 4-byte access. The X byte is blurred along with the
+// colours; it is zero throughout, so it stays zero.
+
+// divide_total() of each of four window totals.
+uchar4 divide_total4(
+	const uint4 total,
+	const ulong multiplier,
+	const unsigned bias,
+	const unsigned shift)
+{
+	return (uchar4)(divide_total(total.x, multiplier, bias, shift),
+	                divide_total(total.y, multiplier, bias, shift),
+	                divide_total(total.z, multiplier, bias, shift),
+	                divide_total(total.w, multiplier, bias, shift));
+}
+
+//------------------------------------------------------------------------------
+//
+// kernel:  blur_rgbx  
+//
+// Purpose: The blur kernel of blur.cl on RGBX pixels
+// 
+// input: out - the blurred image, in - the original image, blur_radius - the range in pixels to be blurred
+// w - the width of the image, h - the height of the image.
+// multiplier, bias & shift - the precomputed reciprocal of nsamples, see divide_total.
+//
+// output: The average of the nsamples pixels within a blur radius (x,y). Pixels which
+// would be outside the image are filled as BORDER_MODE says.
+// The host runs it on the border strips only, and blur_interior_rgbx on the rest.
+
+__kernel void blur_rgbx(
+	__global uchar4* out,
+	__global const uchar4* in,
+	const int blur_radius,
+	const unsigned w,
+	const unsigned h,
+	const ulong multiplier,
+	const unsigned bias,
+	const unsigned shift)
+{
+		int x = get_global_id(0);
+		int y = get_global_id(1);
+
+		uint4 total = (uint4)(0);
+		for (int j = y - RADIUS + 1; j < y + RADIUS; ++j) {
+			const int r_j = border_index(j, h);
+			if (r_j < 0) continue;
+			for (int i = x - RADIUS + 1; i < x + RADIUS; ++i) {
+				const int r_i = border_index(i, w);
+				if (r_i < 0) continue;
+				total += convert_uint4(in[r_j*w + r_i]);
+			}
+		}
+		out[y*w + x] = divide_total4(total, multiplier, bias, shift);
+}
+
+//------------------------------------------------------------------------------
+//
+// kernel:  blur_interior_rgbx  
+//
+// Purpose: The blur_interior kernel of blur.cl on RGBX pixels
+// 
+// input: as blur_rgbx, launched with a global offset over the pixels whose window lies
+// wholly inside the image.
+//
+// output: The same average as blur_rgbx, with no index clamped or checked.
+
+__kernel void blur_interior_rgbx(
+	__global uchar4* out,
+	__global const uchar4* in,
+	const int blur_radius,
+	const unsigned w,
+	const unsigned h,
+	const ulong multiplier,
+	const unsigned bias,
+	const unsigned shift)
+{
+		int x = get_global_id(0);
+		int y = get_global_id(1);
+
+		uint4 total = (uint4)(0);
+		for (int j = y - RADIUS + 1; j < y + RADIUS; ++j)
+			for (int i = x - RADIUS + 1; i < x + RADIUS; ++i)
+				total += convert_uint4(in[j*w + i]);
+		out[y*w + x] = divide_total4(total, multiplier, bias, shift);
+}
+
+//------------------------------------------------------------------------------
+//
+// kernel:  blur_horizontal_rgbx  
+//
+// Purpose: First pass of the separable blur on RGBX pixels
+// 
+// input: out - the row totals, in - the original image, blur_radius - the range in pixels to be blurred
+// w - the width of the image, h - the height of the image.
+//
+// output: The sum of the 2*blur_radius-1 pixels on the same row as (x,y), per channel.
+// Pixels which would be outside the image, replicate the value at the image border.
+
+__kernel void blur_horizontal_rgbx(
+	__global uint4* out,
+	__global const uchar4* in,
+	const int blur_radius,
+	const unsigned w,
+	const unsigned h)
+{
+		int x = get_global_id(0);
+		int y = get_global_id(1);
+
+		uint4 total = (uint4)(0);
+		for (int i = x - RADIUS + 1; i < x + RADIUS; ++i) {
+			const unsigned r_i = i < 0 ? 0 : i >= w ? w - 1 : i;
+			total += convert_uint4(in[y*w + r_i]);
+		}
+		out[y*w + x] = total;
+}
+
+//------------------------------------------------------------------------------
+//
+// kernel:  blur_vertical_rgbx  
+//
+// Purpose: Second pass of the separable blur on RGBX pixels
+// 
+// input: out - the blurred image, in - the row totals from blur_horizontal_rgbx, blur_radius - the range in pixels to be blurred
+// w - the width of the image, h - the height of the image.
+// multiplier, bias & shift - the precomputed reciprocal of nsamples, see divide_total.
+//
+// output: Sums the 2*blur_radius-1 row totals in the same column as (x,y) and divides by nsamples,
+// giving the same average as blur_rgbx. Rows which would be outside the image, replicate the border row.
+
+__kernel void blur_vertical_rgbx(
+	__global uchar4* out,
+	__global const uint4* in,
+	const int blur_radius,
+	const unsigned w,
+	const unsigned h,
+	const ulong multiplier,
+	const unsigned bias,
+	const unsigned shift)
+{
+		int x = get_global_id(0);
+		int y = get_global_id(1);
+
+		uint4 total = (uint4)(0);
+		for (int j = y - RADIUS + 1; j < y + RADIUS; ++j) {
+			const unsigned r_j = j < 0 ? 0 : j >= h ? h - 1 : j;
+			total += in[r_j*w + x];
+		}
+		out[y*w + x] = divide_total4(total, multiplier, bias, shift);
+}
+
+//------------------------------------------------------------------------------
+//
+// kernel:  add_weighted_rgbx  
+//
+// Purpose: The add_weighted kernel of add_weighted.cl on RGBX pixels
+// 
+// input: out - the sharpened image, in1 - the original image, in2 - the blurred image.
+// alpha, beta & gamma - weighting values for the unsharpening calculation. 
+// w - the width of the image, h - the height of the image.
+//
+// output: out(I) = saturate(in1(I)*alpha + in2(I)*beta + gamma) for the four bytes of
+// pixel (x,y); the conversion truncates and saturates as add_weighted does.
+
+__kernel void add_weighted_rgbx(
+	__global uchar4* out,
+	__global const uchar4* in1,
+	const float alpha,
+	__global const uchar4* in2,
+	const float beta,
+	const float gamma,
+	const unsigned w,
+	const unsigned h)
+{
+		int x = get_global_id(0);
+		int y = get_global_id(1);
+
+		const float4 tmp = convert_float4(in1[y*w + x]) * alpha + convert_float4(in2[y*w + x]) * beta + gamma;
+		out[y*w + x] = convert_uchar4_sat(tmp);
+}
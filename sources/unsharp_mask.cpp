@@ -5,26 +5,402 @@
 #include "CL/cl.hpp"
 #include "CL/err_code.h"
 #include "CL/util.hpp" // utility library
+#include "device_workspace.hpp"
 #include <iomanip>
+#include <cstring>
+#include <cstdint>
+#include <sstream>
+#include <map>
+#include <memory>
+
+// The device-side implementations of the box blur.
+enum class device_blur { naive, separable, integral, local, sliding, image };
+
+// How the OpenCL run sharpens: one launch per blur pass and one for
+// add_weighted, or all of them fused into a single launch per tile.
+enum class device_engine { passes, fused };
+
+// The pixel layouts the device kernels can work on: the image as loaded,
+// one plane per channel, or 4-byte RGBX pixels.
+enum class device_layout { interleaved, planar, rgbx };
+
+// Command line names of the host and device blurs, also used as the
+// column headings of the radius sweep.
+static const struct { const char *name; blur_method method; } hostBlurs[] =
+{
+	{ "naive", blur_method::naive }, { "sliding", blur_method::sliding },
+	{ "separable", blur_method::separable }, { "integral", blur_method::integral },
+	{ "transposed", blur_method::transposed }, { "strided", blur_method::strided }
+};
+static const struct { const char *name; device_blur strategy; } deviceBlurs[] =
+{
+	{ "naive", device_blur::naive }, { "separable", device_blur::separable },
+	{ "integral", device_blur::integral }, { "local", device_blur::local },
+	{ "sliding", device_blur::sliding }, { "image", device_blur::image }
+};
+static const struct { const char *name; unsharp_engine engine; } hostEngines[] =
+{
+	{ "frames", unsharp_engine::frames }, { "fused", unsharp_engine::fused },
+	{ "threaded", unsharp_engine::threaded }, { "tiled", unsharp_engine::tiled },
+	{ "planar", unsharp_engine::planar }
+};
+static const struct { const char *name; device_engine engine; } deviceEngines[] =
+{
+	{ "passes", device_engine::passes }, { "fused", device_engine::fused }
+};
+static const struct { const char *name; device_layout layout; } deviceLayouts[] =
+{
+	{ "interleaved", device_layout::interleaved }, { "planar", device_layout::planar },
+	{ "rgbx", device_layout::rgbx }
+};
+
+// Returns the value of a "--name=value" argument, an empty string for a
+// bare "--name", or nullptr when the option was not given.
+static const char *find_option(int argc, char *argv[], const char *name)
+{
+	const size_t length = std::strlen(name);
+	for (int a = 1; a < argc; ++a)
+	{
+		if (std::strncmp(argv[a], "--", 2) != 0 || std::strncmp(argv[a] + 2, name, length) != 0)
+			continue;
+		const char *rest = argv[a] + 2 + length;
+		if (*rest == '=')
+			return rest + 1;
+		if (*rest == '\0')
+			return rest;
+	}
+	return nullptr;
+}
+
+static blur_method parse_blur_method(const char *name)
+{
+	if (name == nullptr) return blur_method::sliding;
+	for (const auto &entry : hostBlurs)
+		if (std::strcmp(name, entry.name) == 0) return entry.method;
+	std::cerr << "Unknown host blur \"" << name << "\", using sliding." << std::endl;
+	return blur_method::sliding;
+}
+
+static unsharp_engine parse_unsharp_engine(const char *name)
+{
+	if (name == nullptr) return unsharp_engine::frames;
+	for (const auto &entry : hostEngines)
+		if (std::strcmp(name, entry.name) == 0) return entry.engine;
+	std::cerr << "Unknown host engine \"" << name << "\", using frames." << std::endl;
+	return unsharp_engine::frames;
+}
+
+static device_engine parse_device_engine(const char *name)
+{
+	if (name == nullptr) return device_engine::passes;
+	for (const auto &entry : deviceEngines)
+		if (std::strcmp(name, entry.name) == 0) return entry.engine;
+	std::cerr << "Unknown device engine \"" << name << "\", using passes." << std::endl;
+	return device_engine::passes;
+}
+
+static blur_rounding parse_blur_rounding(const char *name)
+{
+	if (name == nullptr || std::strcmp(name, "truncate") == 0) return blur_rounding::truncate;
+	if (std::strcmp(name, "nearest") == 0) return blur_rounding::nearest;
+	std::cerr << "Unknown rounding \"" << name << "\", using truncate." << std::endl;
+	return blur_rounding::truncate;
+}
+
+static const struct { const char *name; blur_border border; } blurBorders[] =
+{
+	{ "replicate", blur_border::replicate }, { "reflect", blur_border::reflect },
+	{ "wrap", blur_border::wrap }, { "constant", blur_border::constant }
+};
+
+static blur_border parse_blur_border(const char *name)
+{
+	if (name == nullptr) return blur_border::replicate;
+	for (const auto &entry : blurBorders)
+		if (std::strcmp(name, entry.name) == 0) return entry.border;
+	std::cerr << "Unknown border \"" << name << "\", using replicate." << std::endl;
+	return blur_border::replicate;
+}
+
+static simd_tier parse_simd_tier(const char *name)
+{
+	if (name == nullptr) return detect_simd_tier();
+	if (std::strcmp(name, "scalar") == 0) return simd_tier::scalar;
+	if (std::strcmp(name, "sse41") == 0)  return simd_tier::sse41;
+	if (std::strcmp(name, "avx2") == 0)   return simd_tier::avx2;
+	std::cerr << "Unknown SIMD tier \"" << name << "\", using the detected one." << std::endl;
+	return detect_simd_tier();
+}
+
+static device_layout parse_device_layout(const char *name)
+{
+	if (name == nullptr) return device_layout::interleaved;
+	for (const auto &entry : deviceLayouts)
+		if (std::strcmp(name, entry.name) == 0) return entry.layout;
+	std::cerr << "Unknown device layout \"" << name << "\", using interleaved." << std::endl;
+	return device_layout::interleaved;
+}
+
+// Whether the host engines run on RGBX copies of the image.
+static bool parse_host_layout(const char *name)
+{
+	if (name == nullptr || std::strcmp(name, "interleaved") == 0) return false;
+	if (std::strcmp(name, "rgbx") == 0) return true;
+	std::cerr << "Unknown host layout \"" << name << "\", using interleaved." << std::endl;
+	return false;
+}
+
+static device_blur parse_device_blur(const char *name)
+{
+	if (name == nullptr) return device_blur::naive;
+	for (const auto &entry : deviceBlurs)
+		if (std::strcmp(name, entry.name) == 0) return entry.strategy;
+	std::cerr << "Unknown device blur \"" << name << "\", using naive." << std::endl;
+	return device_blur::naive;
+}
+
+// The bytes of local memory holding a tileW x tileH block of pixels and a
+// halo of halo pixels on every side.
+static cl_ulong local_tile_bytes(const size_t tileW, const size_t tileH, const size_t halo, const unsigned nchannels)
+{
+	return cl_ulong(tileW + 2 * halo) * (tileH + 2 * halo) * nchannels;
+}
+
+// Picks the work-group size of blur_local, or with passes = 3 of unsharp_local:
+// up to maxItems work-items, at most maxW x maxH, whose local memory fits in
+// localBytes, choosing the group that loads the fewest bytes per pixel it
+// writes. A single pass needs its pixels plus a halo of radius-1 on every
+// side; several passes need a halo of radius-1 per pass, and beside it the
+// output of the first pass. Returns false when not even one work-item's
+// tiles fit.
+static bool fit_local_tile(const int radius, const unsigned nchannels, const cl_ulong localBytes,
+	const size_t maxItems, const size_t maxW, const size_t maxH, size_t &tileW, size_t &tileH,
+	const int passes = 1)
+{
+	const size_t reach = radius - 1;
+	double bestCost = 0;
+	bool found = false;
+	for (size_t tw = 1; tw <= maxW && tw <= maxItems; tw *= 2)
+		for (size_t th = 1; th <= maxH && tw * th <= maxItems; th *= 2)
+		{
+			const cl_ulong bytes = local_tile_bytes(tw, th, passes * reach, nchannels)
+				+ (passes > 1 ? local_tile_bytes(tw, th, (passes - 1) * reach, nchannels) : 0);
+			if (bytes > localBytes) continue;
+			// Ties go to the wider group, whose rows are longer runs of memory.
+			const double cost = double(bytes) / (tw * th);
+			if (!found || cost < bestCost || (cost == bestCost && tw > tileW))
+			{
+				bestCost = cost; tileW = tw; tileH = th; found = true;
+			}
+		}
+	return found;
+}
+
+// The pixels each work-item of blur_rows and blur_cols slides its total along:
+// long enough that summing the first window, 2*radius-1 reads, costs no more
+// than the two reads per pixel of the rest of the strip.
+static unsigned sliding_strip(const int radius)
+{
+	return std::max(32u, unsigned(4 * radius));
+}
+
+// Whether large image buffers ask for huge pages.
+static bool parse_huge_pages(const char *setting)
+{
+	if (setting == nullptr || std::strcmp(setting, "on") == 0) return true;
+	if (std::strcmp(setting, "off") == 0) return false;
+	std::cerr << "Unknown huge page setting \"" << setting << "\", using on." << std::endl;
+	return true;
+}
+
+// Whether the sliding blurs keep column totals in 16-bit lanes when the radius allows.
+static bool parse_blur_lanes(const char *width)
+{
+	if (width == nullptr || std::strcmp(width, "16") == 0) return true;
+	if (std::strcmp(width, "32") == 0) return false;
+	std::cerr << "Unknown lane width \"" << width << "\", using 16." << std::endl;
+	return true;
+}
+
+// The number of threads of the host thread pool: a whole number from 1 to
+// max_host_threads, or all hardware threads when not given.
+static const long max_host_threads = 1024;
+static unsigned parse_thread_count(const char *count)
+{
+	const unsigned hardware = std::max(1u, std::thread::hardware_concurrency());
+	if (count == nullptr) return hardware;
+	char *rest = nullptr;
+	const long threads = std::strtol(count, &rest, 10);
+	if (rest != count && *rest == '\0' && threads >= 1 && threads <= max_host_threads)
+		return unsigned(threads);
+	std::cerr << "Invalid thread count \"" << count << "\", expected 1 to " << max_host_threads
+		<< "; using " << hardware << "." << std::endl;
+	return hardware;
+}
+
+// Parses a tile size given as "WxH", or as "N" for square tiles; anything
+// else leaves both at 0, which picks them from the cache size.
+static void parse_tile_size(const char *size, unsigned &tileW, unsigned &tileH)
+{
+	tileW = tileH = 0;
+	if (size == nullptr || *size == '\0')
+		return;
+	char *rest = nullptr;
+	tileW = tileH = std::strtoul(size, &rest, 10);
+	if (*rest == 'x')
+		tileH = std::strtoul(rest + 1, &rest, 10);
+	if (*rest != '\0' || tileW == 0 || tileH == 0)
+	{
+		std::cerr << "Bad tile size \"" << size << "\", picking one from the cache size." << std::endl;
+		tileW = tileH = 0;
+	}
+}
+
+// Parses a comma separated list of blur radii; a bare option gives a default
+// sweep covering our sharpening presets.
+static std::vector<int> parse_radii(const char *list)
+{
+	std::vector<int> radii;
+	if (list == nullptr)
+		return radii;
+	if (*list == '\0')
+		return { 1, 2, 3, 4, 5, 6, 8, 10, 12, 16, 20, 24, 32, 40, 48, 60 };
+	std::stringstream ss(list);
+	std::string item;
+	while (std::getline(ss, item, ','))
+		radii.push_back(std::atoi(item.c_str()));
+	return radii;
+}
 
 // Apply an unsharp mask to the 24-bit PPM loaded from the file path of
 // the first input argument; then write the sharpened output to the file path
 // of the second argument. The third argument provides the blur radius.
+//
+// Options may follow the positional arguments:
+//   --host-blur=naive|sliding|separable|integral|transposed|strided
+//                                                 blur used by the serial run (sliding)
+//   --host-engine=frames|fused|threaded|tiled|planar
+//                                                 frames runs each blur over a whole frame, fused
+//                                                 streams all stages in one sweep, threaded splits
+//                                                 each frame into bands of rows, tiled runs all
+//                                                 stages per cache-sized tile, planar runs frames
+//                                                 on one plane per channel (frames)
+//   --threads=N                                   threads of the threaded and tiled engines, 1 to 1024 (all cores)
+//   --pin                                         pin each of those threads to its own core (ignored by the other engines)
+//   --tile=WxH|N                                  tile size of the tiled engine (fitted to the L2 cache)
+//   --device-blur=naive|separable|integral|local|sliding|image
+//                                                 blur kernels used by the OpenCL run; local sums each
+//                                                 window from a work-group tile in local memory, sliding
+//                                                 slides row and column totals along strips, image
+//                                                 blurs RGBA images sampled clamped to edge (naive)
+//   --device-engine=passes|fused                  passes launches each blur and add_weighted in turn,
+//                                                 fused runs all four per work-group tile in local
+//                                                 memory up to radius 8, replicating the border (passes)
+//   --host-layout=interleaved|rgbx                pixel layout the serial run works on (interleaved)
+//   --device-layout=interleaved|planar|rgbx       pixel layout of the OpenCL run's kernels (interleaved)
+//   --rounding=truncate|nearest                   how both runs round blurred averages (truncate)
+//   --border=replicate|reflect|wrap|constant      how the naive blurs fill windows past the edge;
+//                                                 the other blurs always replicate (replicate)
+//   --simd=scalar|sse41|avx2                      caps the host row kernels' vector tier (detected)
+//   --huge-pages=on|off                           put large image buffers on huge pages when available (on)
+//   --lanes=16|32                                 lane width of the sliding blurs' column totals; 16 is
+//                                                 only used up to radius 129, where they fit (16)
+//   --stream                                      sharpen row by row from file to file in
+//                                                 O(width * radius) memory, then exit
+//   --sweep[=r1,r2,...]                  time a single blur pass of every host and
+//                                        device blur at each radius, then exit
 
 int main(int argc, char *argv[])
 {
-		const char *ifilename = argc > 1 ? argv[1] : "../images/ghost-town/ghost-town-in.ppm";
-		const char *ofilename = argc > 2 ? argv[2] : "../images/ghost-town/ghost-town-out.ppm";
-		const int blur_radius = argc > 3 ? std::atoi(argv[3]) : 5;
+		std::vector<const char *> positional;
+		for (int a = 1; a < argc; ++a)
+			if (std::strncmp(argv[a], "--", 2) != 0)
+				positional.push_back(argv[a]);
+
+		const char *ifilename = positional.size() > 0 ? positional[0] : "../images/ghost-town/ghost-town-in.ppm";
+		const char *ofilename = positional.size() > 1 ? positional[1] : "../images/ghost-town/ghost-town-out.ppm";
+		const int blur_radius = positional.size() > 2 ? std::atoi(positional[2]) : 5;
+		const blur_method hostBlur = parse_blur_method(find_option(argc, argv, "host-blur"));
+		const unsharp_engine hostEngine = parse_unsharp_engine(find_option(argc, argv, "host-engine"));
+		const device_blur deviceBlur = parse_device_blur(find_option(argc, argv, "device-blur"));
+		const device_engine deviceEngine = parse_device_engine(find_option(argc, argv, "device-engine"));
+		device_layout deviceLayout = parse_device_layout(find_option(argc, argv, "device-layout"));
+		bool hostPadded = parse_host_layout(find_option(argc, argv, "host-layout"));
+		const blur_rounding rounding = parse_blur_rounding(find_option(argc, argv, "rounding"));
+		const blur_border border = parse_blur_border(find_option(argc, argv, "border"));
+		// Only the naive blurs, which the frames and planar engines can run, fill the border other ways.
+		const blur_border hostBorder = hostBlur == blur_method::naive
+			&& (hostEngine == unsharp_engine::frames || hostEngine == unsharp_engine::planar) ? border : blur_border::replicate;
+		const blur_border deviceBorder = deviceEngine == device_engine::passes
+			&& (deviceBlur == device_blur::naive || deviceBlur == device_blur::local) ? border : blur_border::replicate;
+		if (hostBorder != border || deviceBorder != border)
+			std::cerr << "Only the naive blurs implement border modes other than replicate; the "
+				<< (hostBorder != border ? "serial" : "OpenCL") << " run replicates." << std::endl;
+		const simd_tier simdTier = select_row_kernels(parse_simd_tier(find_option(argc, argv, "simd")));
+		const char *threadsOption = find_option(argc, argv, "threads");
+		unsigned tileW, tileH;
+		parse_tile_size(find_option(argc, argv, "tile"), tileW, tileH);
+		image_huge_pages() = parse_huge_pages(find_option(argc, argv, "huge-pages"));
+		narrow_blur_lanes() = parse_blur_lanes(find_option(argc, argv, "lanes"));
+
+  // The worker threads are started once and reused by every threaded run.
+  // Only the threaded and tiled engines use them, so other runs start none
+  // and have no threads for --pin to pin.
+  const bool poolEngine = hostEngine == unsharp_engine::threaded || hostEngine == unsharp_engine::tiled;
+  const bool pinThreads = find_option(argc, argv, "pin") != nullptr;
+  if (pinThreads && !poolEngine)
+	  std::cerr << "Only the threaded and tiled engines run on a thread pool; ignoring --pin." << std::endl;
+  std::unique_ptr<thread_pool> pool;
+  if (poolEngine)
+	  pool.reset(new thread_pool(parse_thread_count(threadsOption), pinThreads));
+		const std::vector<int> sweepRadii = parse_radii(find_option(argc, argv, "sweep"));
+
+  // Streaming mode: sharpen the file row by row into the output file without
+  // ever holding either image whole, then exit.
+  if (find_option(argc, argv, "stream"))
+  {
+	  ppm_row_reader reader(ifilename);
+	  ppm_row_writer writer(ofilename, reader.magic, reader.w, reader.h, reader.max);
+	  std::vector<unsigned char> row(reader.w * reader.nchannels);
+	  double firstRowTime = 0;
+
+	  std::cout << "Streaming from " << ifilename << " to " << ofilename << "\n" << std::endl;
+	  auto streamPreTimer = std::chrono::steady_clock::now();
+	  unsharp_stream stream(blur_radius, reader.w, reader.h, reader.nchannels,
+		  [&](unsigned y, const unsigned char *sharpened)
+	  {
+		  if (y == 0)
+			  firstRowTime = std::chrono::duration<double, std::ratio<1, 1000>>(std::chrono::steady_clock::now() - streamPreTimer).count();
+		  writer.write_row(sharpened);
+	  }, rounding);
+	  for (unsigned y = 0; y < reader.h && reader.read_row(row.data()); y++)
+		  stream.push_row(row.data());
+	  auto streamPostTimer = std::chrono::steady_clock::now();
+
+	  std::cout << std::fixed << std::setprecision(1)
+		  << "Streamed " << stream.rows_emitted() << " of " << reader.h << " rows in "
+		  << std::chrono::duration<double, std::ratio<1, 1000>>(streamPostTimer - streamPreTimer).count()
+		  << " milliseconds; the first row was written after " << firstRowTime << " milliseconds.\n"
+		  << "Rows were buffered in " << stream.bytes_used() << " bytes, against "
+		  << 4ull * reader.w * reader.h * reader.nchannels << " for whole frames." << std::endl;
+	  return 0;
+  }
 
   ppm img;
   int testCaseSize = 6, testCaseIgnoreBuffer = 2;
 
   struct Buffers 
   {
-	  std::vector<unsigned char> h_original_image, h_blurred_image, h_sharpened_image;
+	  image_buffer h_original_image, h_blurred_image, h_sharpened_image;
+	  image_buffer h_padded_original, h_padded_sharpened; // RGBX copies for --host-layout=rgbx
+	  image_buffer h_placed_original; // NUMA-placed copy for the threaded engine
 	  cl::Buffer d_original_image, d_sharpened_image;
+	  cl::Buffer d_layout_image; // The original image in a planar or RGBX device layout
 	  cl::Buffer d_blurred_image1, d_blurred_image2;
+	  cl::Buffer d_row_totals; // Intermediate of the separable blur
+	  cl::Buffer d_integral;   // Summed-area tables of the integral blur
+	  cl::Image2D d_source_texels, d_blurred_texels1, d_blurred_texels2; // RGBA images of the image blur
+
   }buffers;
   
   struct ImageValues
@@ -34,7 +410,15 @@ int main(int argc, char *argv[])
 
   // Discover number of platforms
   std::vector<cl::Platform> platforms;
-  cl::Platform::get(&platforms);
+  try
+  {
+	  cl::Platform::get(&platforms);
+  }
+  catch (const cl::Error &)
+  {
+	  // No OpenCL runtime is installed; only the host engines can run.
+	  platforms.clear();
+  }
   std::cout << "\nNumber of OpenCL plaforms: " << platforms.size() << std::endl;
 
   // Investigate each platform
@@ -116,11 +500,16 @@ int main(int argc, char *argv[])
 	  std::cout << "CPU Selected." << std::endl;
   }
   // Create a context
-  cl::Context context(deviceSelection);
+  cl::Context context;
+  std::vector<cl::Device> deviceList;
+  if (!platforms.empty())
+  {
+	  context = cl::Context(deviceSelection);
+	  deviceList = context.getInfo<CL_CONTEXT_DEVICES>();
+  }
 
   //Create cl Event
   cl::Event event;
-  auto deviceList = context.getInfo<CL_CONTEXT_DEVICES>();
   //Create a program object for the context
   cl::Program program;
 
@@ -128,26 +517,106 @@ int main(int argc, char *argv[])
   std::cout << "Reading from " << ifilename << "\n" << std::endl;
   img.read(ifilename, buffers.h_original_image);
 
+  // The RGBX layouts pad RGB pixels; graymaps keep their single channel.
+  if (img.nchannels != 3 && (hostPadded || deviceLayout == device_layout::rgbx))
+  {
+	  std::cerr << "The RGBX layouts need an RGB image, using interleaved pixels." << std::endl;
+	  hostPadded = false;
+	  if (deviceLayout == device_layout::rgbx)
+		  deviceLayout = device_layout::interleaved;
+  }
+
   // Allocate space for the blurred output image
   buffers.h_blurred_image.resize(img.w * img.h * img.nchannels);
   // Allocate space for the sharpened output image
   buffers.h_sharpened_image.resize(img.w * img.h * img.nchannels);
+  // The host engines read and write RGBX copies when asked to
+  const unsigned hostChannels = hostPadded ? 4 : img.nchannels;
+  if (hostPadded)
+  {
+	  buffers.h_padded_original.resize(img.w * img.h * 4);
+	  buffers.h_padded_sharpened.resize(img.w * img.h * 4);
+  }
+  // The threaded engine reads a copy of the input whose row bands were
+  // written by the threads that blur them, and its output is first touched
+  // the same way, so each band sits on its worker's NUMA node.
+  const bool hostPlaced = hostEngine == unsharp_engine::threaded && !hostPadded;
+  if (hostPlaced)
+  {
+	  const std::size_t rowSize = img.w * img.nchannels;
+	  buffers.h_placed_original.resize(img.h * rowSize);
+	  copy_rows_placed(*pool, buffers.h_placed_original.data(), buffers.h_original_image.data(), img.h, rowSize);
+	  first_touch_rows(*pool, buffers.h_sharpened_image.data(), img.h, rowSize);
+  }
 
   std::cout << "Reading complete from " << ifilename << " Serial execution will now begin.\n" << std::endl;
+  std::cout << "Host row kernels use " << simd_tier_name(simdTier) << " instructions"
+	  << " with " << (use_16_bit_lanes(blur_radius) ? 16 : 32) << "-bit column totals";
+  if (hostEngine == unsharp_engine::threaded || hostEngine == unsharp_engine::tiled)
+	  std::cout << ", on " << pool->size() << (pool->is_pinned() ? " pinned" : "") << " threads";
+  if (hostEngine == unsharp_engine::tiled)
+  {
+	  if (tileW == 0 || tileH == 0)
+		  auto_tile_size(blur_radius, img.w, img.h, hostChannels, detect_cache_sizes().l2, tileW, tileH);
+	  std::cout << ", in " << tileW << "x" << tileH << " tiles";
+  }
+  if (hostPadded)
+	  std::cout << ", on RGBX pixels";
+  std::cout << ".\n" << std::endl;
   
   //////////////////////////////////////////////////////////////////////////////////////////////////////
   ///////////////////////////////////// Serial Execution BEGIN /////////////////////////////////////////
   //////////////////////////////////////////////////////////////////////////////////////////////////////
   double serialExecutionResult = 0, serialExecutionAverage = 0;
+  // The intermediate frames are allocated on the first iteration and reused.
+  unsharp_workspace hostWorkspace;
+  // Milliseconds per blur pass of each host blur, by --sweep radius.
+  std::vector<std::vector<double>> hostSweep;
 
+  if (sweepRadii.empty())
+  {
 std::cout << "Serial process is being cycled to filter out erroneous values, please be patient... \n" << std::endl;
 
   for (int i = 0; i < (testCaseSize + testCaseIgnoreBuffer); i++)
   {
 		  auto serialExecutionPreTimer = std::chrono::steady_clock::now();
 
-		  unsharp_mask(buffers.h_sharpened_image.data(), buffers.h_original_image.data(), blur_radius,
-			  img.w, img.h, img.nchannels);
+		  // Pad to RGBX on the way in and back to RGB on the way out, within the timing.
+		  const unsigned char *hostIn = hostPlaced ? buffers.h_placed_original.data() : buffers.h_original_image.data();
+		  unsigned char *hostOut = buffers.h_sharpened_image.data();
+		  if (hostPadded)
+		  {
+			  active_row_kernels().pad_rgbx(buffers.h_padded_original.data(), hostIn, img.w * img.h);
+			  hostIn = buffers.h_padded_original.data();
+			  hostOut = buffers.h_padded_sharpened.data();
+		  }
+
+		  switch (hostEngine)
+		  {
+		  case unsharp_engine::frames:
+			  unsharp_mask(hostOut, hostIn, blur_radius,
+				  img.w, img.h, hostChannels, hostWorkspace, hostBlur, rounding, hostBorder);
+			  break;
+		  case unsharp_engine::fused:
+			  unsharp_mask_fused(hostOut, hostIn, blur_radius,
+				  img.w, img.h, hostChannels, rounding);
+			  break;
+		  case unsharp_engine::threaded:
+			  unsharp_mask_threaded(hostOut, hostIn, blur_radius,
+				  img.w, img.h, hostChannels, *pool, hostWorkspace, rounding);
+			  break;
+		  case unsharp_engine::tiled:
+			  unsharp_mask_tiled(hostOut, hostIn, blur_radius,
+				  img.w, img.h, hostChannels, tileW, tileH, pool.get(), rounding);
+			  break;
+		  case unsharp_engine::planar:
+			  unsharp_mask_planar(hostOut, hostIn, blur_radius,
+				  img.w, img.h, hostChannels, hostWorkspace, hostBlur, rounding, hostBorder);
+			  break;
+		  }
+
+		  if (hostPadded)
+			  active_row_kernels().unpad_rgbx(buffers.h_sharpened_image.data(), hostOut, img.w * img.h);
 
 		  auto serialExecutionPostTimer = std::chrono::steady_clock::now();
 		  serialExecutionResult = std::chrono::duration<double, std::ratio<1, 1000>>(serialExecutionPostTimer - serialExecutionPreTimer).count();
@@ -172,6 +641,53 @@ std::cout << "Serial process is being cycled to filter out erroneous values, ple
 	  << (serialExecutionAverage /= testCaseSize)
 	  << " milliseconds.\n"
 	  << std::endl;
+  if (hostWorkspace.bytes_allocated() > 0)
+	  std::cout << "Host workspace allocated " << hostWorkspace.bytes_allocated()
+		  << " bytes over " << (testCaseSize + testCaseIgnoreBuffer) << " iterations.\n" << std::endl;
+  if (hostPlaced)
+  {
+	  // Where the pages of each band are, against the node of the thread working on it.
+	  numa_traffic traffic;
+	  const std::size_t rowSize = img.w * img.nchannels;
+	  count_band_pages(*pool, buffers.h_placed_original.data(), img.h, rowSize, traffic);
+	  count_band_pages(*pool, buffers.h_sharpened_image.data(), img.h, rowSize, traffic);
+	  count_band_pages(*pool, hostWorkspace.frame(0), img.h, rowSize, traffic);
+	  std::cout << "NUMA: " << numa_node_count() << " node(s); " << traffic.remote_pages << " of "
+		  << traffic.local_pages + traffic.remote_pages << " pages the band workers use are on another node ("
+		  << std::setprecision(1) << 100 * traffic.remote_share() << "% cross-node)";
+	  if (traffic.unknown_pages > 0)
+		  std::cout << ", " << traffic.unknown_pages << " pages on an unknown node";
+	  std::cout << ".\n" << std::endl;
+  }
+  }
+  else
+  {
+	  // The host columns of the sweep, timed here so that they do not need a device.
+	  for (const int radius : sweepRadii)
+	  {
+		  std::vector<double> row;
+		  for (const auto &entry : hostBlurs)
+		  {
+			  double best = 0;
+			  for (int i = 0; i < testCaseSize; i++)
+			  {
+				  auto preTimer = std::chrono::steady_clock::now();
+				  ::blur(buffers.h_blurred_image.data(), buffers.h_original_image.data(), radius,
+					  img.w, img.h, img.nchannels, entry.method);
+				  auto postTimer = std::chrono::steady_clock::now();
+				  double result = std::chrono::duration<double, std::ratio<1, 1000>>(postTimer - preTimer).count();
+				  best = (i == 0 || result < best) ? result : best;
+			  }
+			  row.push_back(best);
+		  }
+		  hostSweep.push_back(row);
+	  }
+  }
+  std::cout << image_memory_stats().huge_page_buffers << " of " << image_memory_stats().large_buffers
+	  << " large host buffers were put on explicit huge pages, and "
+	  << image_memory_stats().transparent_buffers << " requested transparent huge pages.\n" << std::endl;
+  // Keep the serial result to test the parallel results against.
+  const image_buffer h_serial_image = buffers.h_sharpened_image;
 
   //////////////////////////////////////////////////////////////////////////////////////////////////////
   ////////////////////////////////////// Serial Execution END //////////////////////////////////////////
@@ -185,28 +701,148 @@ std::cout << "Serial process is being cycled to filter out erroneous values, ple
   // Placeholders for the Parallel Timers.
   std::chrono::time_point<std::chrono::steady_clock> parallelExecutionPreTimer, parallelExecutionPostTimer;
   double parallelExecutionResult = 0, parallelExecutionAverage =0;
-  try
+  // The sweep table's header, with the device blurs' columns when there is a
+  // device, and the host columns of row r, which the device columns follow.
+  auto printSweepHeader = [&](const bool withDevice)
+  {
+	  std::cout << "Milliseconds per blur pass (best of " << testCaseSize << ")\n" << std::setw(8) << "radius";
+	  for (const auto &entry : hostBlurs)
+		  std::cout << std::setw(std::strlen(entry.name) + 7) << ("host " + std::string(entry.name));
+	  if (withDevice)
+		  for (const auto &entry : deviceBlurs)
+			  std::cout << std::setw(std::strlen(entry.name) + 9) << ("device " + std::string(entry.name));
+	  std::cout << std::endl;
+  };
+  auto printHostSweep = [&](const std::size_t r)
+  {
+	  std::cout << std::setw(8) << sweepRadii[r] << std::fixed << std::setprecision(1);
+	  for (std::size_t m = 0; m < hostSweep[r].size(); m++)
+		  std::cout << std::setw(std::strlen(hostBlurs[m].name) + 7) << hostSweep[r][m];
+  };
+
+  if (platforms.empty())
+  {
+	  if (sweepRadii.empty())
+		  std::cout << "No OpenCL platform was found, so only the serial run took place.\n" << std::endl;
+	  else
+	  {
+		  printSweepHeader(false);
+		  for (std::size_t r = 0; r < sweepRadii.size(); r++)
+		  {
+			  printHostSweep(r);
+			  std::cout << std::endl;
+		  }
+		  std::cout << "\nNo OpenCL platform was found, so only the host blurs were timed.\n" << std::endl;
+	  }
+  }
+  else try
   {
 	  // Get the command queue
 	  cl::CommandQueue queue(context);
 
-	  // Load Kernel Source
-	  program = cl::Program(context, util::loadProgram("../sources/blur.cl"));
-	  // Build the cl file to check for errors.
-	  program.build(context.getInfo<CL_CONTEXT_DEVICES>());
-	  // Create the kernel
-	  auto blur = cl::make_kernel<cl::Buffer,
-								  cl::Buffer,
-								  const int,
-							      const unsigned,
-							      const unsigned,
-							      const unsigned>(program, "blur");
+	  // Channels per pixel as the device kernels see them.
+	  const unsigned deviceChannels = deviceLayout == device_layout::rgbx ? 4 : img.nchannels;
+	  // The blur kernels index pixels through PIXEL_INDEX, which PLANAR_LAYOUT
+	  // selects, and unroll their channel loops for the NCHANNELS they are built for.
+	  // The naive ones fill the border as BORDER_MODE says.
+	  const std::string layoutOptions = std::string(deviceLayout == device_layout::planar ? "-D PLANAR_LAYOUT " : "")
+		  + "-D NCHANNELS=" + std::to_string(deviceChannels)
+		  + " -D BORDER_MODE=" + std::to_string(static_cast<int>(deviceBorder));
+	  const std::string channelOptions = "-D NCHANNELS=" + std::to_string(img.nchannels);
+
+	  // The blur kernels of blur.cl and rgbx.cl, built once per radius and kept for
+	  // the whole run. Like the host's radius-specialised kernels, a radius from
+	  // min_fixed_radius to max_fixed_radius is built with -D BLUR_RADIUS, so the
+	  // window loops unroll and nsamples is a constant; any other radius shares
+	  // one generic build that takes it as an argument.
+	  typedef cl::make_kernel<cl::Buffer, cl::Buffer, const int, const unsigned, const unsigned, const unsigned,
+		  const std::uint64_t, const unsigned, const unsigned> BlurKernel;
+	  typedef cl::make_kernel<cl::Buffer, cl::Buffer, const int, const unsigned, const unsigned, const unsigned> HorizontalKernel;
+	  typedef cl::make_kernel<cl::Buffer, cl::Buffer, const int, const unsigned, const unsigned,
+		  const std::uint64_t, const unsigned, const unsigned> RgbxBlurKernel;
+	  typedef cl::make_kernel<cl::Buffer, cl::Buffer, const int, const unsigned, const unsigned> RgbxHorizontalKernel;
+	  typedef cl::make_kernel<cl::Buffer, cl::Buffer, const int, const unsigned, const unsigned, const unsigned,
+		  const std::uint64_t, const unsigned, const unsigned, cl::LocalSpaceArg> LocalBlurKernel;
+	  typedef cl::make_kernel<cl::Buffer, cl::Buffer, const int, const unsigned, const unsigned, const unsigned,
+		  const std::uint64_t, const unsigned, const unsigned, const float, const float, const float,
+		  cl::LocalSpaceArg, cl::LocalSpaceArg> FusedKernel;
+	  typedef cl::make_kernel<cl::Buffer, cl::Buffer, const int, const unsigned, const unsigned, const unsigned,
+		  const unsigned> RowsKernel;
+	  typedef cl::make_kernel<cl::Buffer, cl::Buffer, const int, const unsigned, const unsigned, const unsigned,
+		  const std::uint64_t, const unsigned, const unsigned, const unsigned> ColsKernel;
+	  struct RadiusKernels
+	  {
+		  explicit RadiusKernels(const cl::Program &program)
+			  : blur(program, "blur"), blur_interior(program, "blur_interior"),
+			  blur_horizontal(program, "blur_horizontal"), blur_vertical(program, "blur_vertical"),
+			  blur_rgbx(program, "blur_rgbx"), blur_interior_rgbx(program, "blur_interior_rgbx"),
+			  blur_horizontal_rgbx(program, "blur_horizontal_rgbx"),
+			  blur_vertical_rgbx(program, "blur_vertical_rgbx"),
+			  localKernel(program, "blur_local"), blur_local(localKernel),
+			  blur_rows(program, "blur_rows"), blur_cols(program, "blur_cols"),
+			  fusedKernel(program, "unsharp_local"), unsharp_local(fusedKernel) {}
+
+		  BlurKernel blur;
+		  BlurKernel blur_interior;
+		  HorizontalKernel blur_horizontal;
+		  BlurKernel blur_vertical;
+		  RgbxBlurKernel blur_rgbx;
+		  RgbxBlurKernel blur_interior_rgbx;
+		  RgbxHorizontalKernel blur_horizontal_rgbx;
+		  RgbxBlurKernel blur_vertical_rgbx;
+		  cl::Kernel localKernel;
+		  LocalBlurKernel blur_local;
+		  RowsKernel blur_rows;
+		  ColsKernel blur_cols;
+		  cl::Kernel fusedKernel;
+		  FusedKernel unsharp_local;
+	  };
+	  std::map<int, RadiusKernels> radiusKernels;
+	  auto kernelsFor = [&](const int radius) -> RadiusKernels &
+	  {
+		  const int key = radius >= min_fixed_radius && radius <= max_fixed_radius ? radius : 0;
+		  auto found = radiusKernels.find(key);
+		  if (found == radiusKernels.end())
+		  {
+			  cl::Program radiusProgram(context, util::loadProgram("../sources/blur.cl") + util::loadProgram("../sources/rgbx.cl")
+				  + util::loadProgram("../sources/fused.cl"));
+			  const std::string radiusOptions = layoutOptions + (key ? " -D BLUR_RADIUS=" + std::to_string(key) : "");
+			  radiusProgram.build(context.getInfo<CL_CONTEXT_DEVICES>(), radiusOptions.c_str());
+			  found = radiusKernels.emplace(key, RadiusKernels(radiusProgram)).first;
+		  }
+		  return found->second;
+	  };
+
+	  // Create the summed-area table kernels, which share divide_total() from blur.cl
+	  program = cl::Program(context, util::loadProgram("../sources/blur.cl") + util::loadProgram("../sources/integral.cl"));
+	  program.build(context.getInfo<CL_CONTEXT_DEVICES>(), layoutOptions.c_str());
+	  auto integral_rows = cl::make_kernel<cl::Buffer,
+										   cl::Buffer,
+										   const unsigned,
+										   const unsigned,
+										   const unsigned>(program, "integral_rows");
+	  auto integral_columns = cl::make_kernel<cl::Buffer,
+											  const unsigned,
+											  const unsigned,
+											  const unsigned>(program, "integral_columns");
+	  // The divisor's 64-bit multiplier is a std::uint64_t here and in the other
+	  // kernels' argument lists: cl_ulong is the same type with an alignment
+	  // attribute, which a template argument drops with a warning.
+	  auto blur_integral = cl::make_kernel<cl::Buffer,
+										   cl::Buffer,
+										   const int,
+										   const unsigned,
+										   const unsigned,
+										   const unsigned,
+										   const std::uint64_t,
+										   const unsigned,
+										   const unsigned>(program, "blur_integral");
 
 
 	  // Create Add_Weighted Kernel
 	  program = cl::Program(context, util::loadProgram("../sources/add_weighted.cl"));
 	  // Build the cl file to check for errors.
-	  program.build(context.getInfo<CL_CONTEXT_DEVICES>());
+	  program.build(context.getInfo<CL_CONTEXT_DEVICES>(), channelOptions.c_str());
 
 	  // Create the kernel 
 	  auto add_weighted = cl::make_kernel<cl::Buffer,
@@ -219,14 +855,306 @@ std::cout << "Serial process is being cycled to filter out erroneous values, ple
 										  const unsigned int,
 										  const unsigned int>(program, "add_weighted");
 
+	  // Create the layout conversion kernels
+	  program = cl::Program(context, util::loadProgram("../sources/layout.cl"));
+	  program.build(context.getInfo<CL_CONTEXT_DEVICES>());
+	  auto deinterleave = cl::make_kernel<cl::Buffer,
+										  cl::Buffer,
+										  const unsigned,
+										  const unsigned,
+										  const unsigned>(program, "deinterleave");
+	  auto interleave = cl::make_kernel<cl::Buffer,
+										cl::Buffer,
+										const unsigned,
+										const unsigned,
+										const unsigned>(program, "interleave");
+	  auto pad_rgbx = cl::make_kernel<cl::Buffer,
+									  cl::Buffer,
+									  const unsigned,
+									  const unsigned>(program, "pad_rgbx");
+	  auto unpad_rgbx = cl::make_kernel<cl::Buffer,
+										cl::Buffer,
+										const unsigned,
+										const unsigned>(program, "unpad_rgbx");
+
+	  // Create the RGBX add_weighted kernel, which shares divide_total() from blur.cl
+	  program = cl::Program(context, util::loadProgram("../sources/blur.cl") + util::loadProgram("../sources/rgbx.cl"));
+	  program.build(context.getInfo<CL_CONTEXT_DEVICES>());
+	  auto add_weighted_rgbx = cl::make_kernel<cl::Buffer,
+											   cl::Buffer,
+											   const float,
+											   cl::Buffer,
+											   const float,
+											   const float,
+											   const unsigned,
+											   const unsigned>(program, "add_weighted_rgbx");
+
+	  // Create the image blur kernels where the device has images; they read the
+	  // original image interleaved whatever the device layout.
+	  const cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+	  const bool imageSupport = device.getInfo<CL_DEVICE_IMAGE_SUPPORT>() == CL_TRUE;
+	  struct ImageKernels
+	  {
+		  explicit ImageKernels(const cl::Program &program)
+			  : pixels_to_image(program, "pixels_to_image"), blur_image(program, "blur_image"),
+			  add_weighted_image(program, "add_weighted_image") {}
+
+		  cl::make_kernel<cl::Image2D, cl::Buffer, const unsigned, const unsigned, const unsigned> pixels_to_image;
+		  cl::make_kernel<cl::Image2D, cl::Image2D, const int, const std::uint64_t, const unsigned, const unsigned> blur_image;
+		  cl::make_kernel<cl::Buffer, cl::Buffer, const float, cl::Image2D, const float, const float,
+			  const unsigned, const unsigned, const unsigned> add_weighted_image;
+	  };
+	  std::unique_ptr<ImageKernels> imageKernels;
+	  if (imageSupport)
+	  {
+		  program = cl::Program(context, util::loadProgram("../sources/blur.cl") + util::loadProgram("../sources/rgbx.cl")
+			  + util::loadProgram("../sources/image.cl"));
+		  program.build(context.getInfo<CL_CONTEXT_DEVICES>(), channelOptions.c_str());
+		  imageKernels.reset(new ImageKernels(program));
+	  }
+	  else if (deviceBlur == device_blur::image)
+		  std::cout << "The OpenCL device has no image support, so the naive blur runs instead.\n" << std::endl;
+
 	  //L auto workGroupSize = add_weighted.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(cl::Device::getDefault());
 	  //L auto numWorkGroups = h_original_image.size() / workGroupSize;
 
-	  std::cout << "Parallel process is being cycled to filter out erroneous values, please be patient... \n" << std::endl;
 	  //Assign buffer
 	  buffers.d_original_image = cl::Buffer(context, buffers.h_original_image.begin(), buffers.h_original_image.end(), CL_MEM_READ_ONLY, true);
 	  buffers.d_sharpened_image = cl::Buffer(context, buffers.h_sharpened_image.begin(), buffers.h_sharpened_image.end(), CL_MEM_READ_WRITE, true);
-	  
+	  // The scratch buffers come from a workspace that keeps them for every run on this context.
+	  device_workspace deviceWorkspace(context);
+	  buffers.d_row_totals = deviceWorkspace.buffer(device_workspace::row_totals, img.w * img.h * deviceChannels * sizeof(cl_uint));
+	  buffers.d_integral = deviceWorkspace.buffer(device_workspace::integral, (img.w + 1) * (img.h + 1) * deviceChannels * sizeof(cl_uint));
+	  buffers.d_layout_image = deviceWorkspace.buffer(device_workspace::layout_image, img.w * img.h * deviceChannels);
+	  // The blurred images hold deviceChannels per pixel too.
+	  buffers.h_blurred_image.resize(img.w * img.h * deviceChannels);
+	  // The image the blur kernels read: the original, or its planar or RGBX copy.
+	  cl::Buffer &d_source_image = deviceLayout == device_layout::interleaved ? buffers.d_original_image : buffers.d_layout_image;
+	  if (imageKernels)
+	  {
+		  // Image2D takes its format by value, so it gets a temporary: copying a named
+		  // cl::ImageFormat uses its deprecated implicit copy constructor.
+		  auto rgbaImage = [&]() { return cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_RGBA, CL_UNORM_INT8), img.w, img.h); };
+		  buffers.d_source_texels = rgbaImage();
+		  buffers.d_blurred_texels1 = rgbaImage();
+		  buffers.d_blurred_texels2 = rgbaImage();
+	  }
+
+	  // Converts the original image to the device layout on the device.
+	  auto convertIn = [&]()
+	  {
+		  if (deviceLayout == device_layout::planar)
+			  deinterleave(cl::EnqueueArgs(queue, cl::NDRange(img.w, img.h)),
+				  buffers.d_layout_image, buffers.d_original_image, img.w, img.h, img.nchannels);
+		  else if (deviceLayout == device_layout::rgbx)
+			  pad_rgbx(cl::EnqueueArgs(queue, cl::NDRange(img.w, img.h)),
+				  buffers.d_layout_image, buffers.d_original_image, img.w, img.h);
+	  };
+
+	  // Launches interior on the pixels whose window lies wholly inside the image
+	  // and border on the four strips around them, split as blur_interior_border()
+	  // splits the image on the host.
+	  typedef std::function<void(const cl::EnqueueArgs &)> Launch;
+	  auto interiorAndBorder = [&](const int radius, const Launch &interior, const Launch &border)
+	  {
+		  int x0, x1, y0, y1;
+		  interior_range(radius - 1, img.w, x0, x1);
+		  interior_range(radius - 1, img.h, y0, y1);
+		  auto region = [&](const Launch &launch, const int xa, const int ya, const int xb, const int yb)
+		  {
+			  if (xa < xb && ya < yb)
+				  launch(cl::EnqueueArgs(queue, cl::NDRange(xa, ya), cl::NDRange(xb - xa, yb - ya), cl::NullRange));
+		  };
+		  region(interior, x0, y0, x1, y1);
+		  region(border, 0, 0, img.w, y0);
+		  region(border, 0, y1, img.w, img.h);
+		  region(border, 0, y0, x0, y1);
+		  region(border, x1, y0, img.w, y1);
+	  };
+
+	  // The work-group size of blur_local at a radius, fitted to the device's local
+	  // memory less what the kernel itself uses; false when even one work-item's
+	  // tile and halo would not fit.
+	  const cl_ulong localMemSize = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+	  const std::vector<size_t> maxItemSizes = device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>();
+	  auto localTile = [&](RadiusKernels &kernels, const int radius, size_t &tileW, size_t &tileH)
+	  {
+		  const cl_ulong used = kernels.localKernel.getWorkGroupInfo<CL_KERNEL_LOCAL_MEM_SIZE>(device);
+		  return used < localMemSize && fit_local_tile(radius, deviceChannels, localMemSize - used,
+			  kernels.localKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device),
+			  maxItemSizes[0], maxItemSizes[1], tileW, tileH);
+	  };
+	  // The same for unsharp_local, whose tiles hold three passes' halo. Past
+	  // max_fixed_radius, recomputing the halo of every tile three times costs
+	  // more than the round trips it saves, and the passes engine runs instead.
+	  auto fusedTile = [&](RadiusKernels &kernels, const int radius, size_t &tileW, size_t &tileH)
+	  {
+		  const cl_ulong used = kernels.fusedKernel.getWorkGroupInfo<CL_KERNEL_LOCAL_MEM_SIZE>(device);
+		  return radius <= max_fixed_radius && used < localMemSize
+			  && fit_local_tile(radius, deviceChannels, localMemSize - used,
+				  kernels.fusedKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device),
+				  maxItemSizes[0], maxItemSizes[1], tileW, tileH, 3);
+	  };
+
+	  // Copies the original image into d_source_texels for the image blur.
+	  auto convertInTexels = [&]()
+	  {
+		  imageKernels->pixels_to_image(cl::EnqueueArgs(queue, cl::NDRange(img.w, img.h)),
+			  buffers.d_source_texels, buffers.d_original_image, img.w, img.h, img.nchannels);
+	  };
+
+	  // Enqueues a single pass of the image blur from in to out.
+	  auto imagePass = [&](cl::Image2D &out, cl::Image2D &in, const int radius)
+	  {
+		  const box_divisor divide(box_samples(radius), rounding);
+		  imageKernels->blur_image(cl::EnqueueArgs(queue, cl::NDRange(img.w, img.h)),
+			  out, in, radius, divide.multiplier, divide.bias, divide.shift);
+	  };
+
+	  // Enqueues a single blur pass from in to out using the selected device blur.
+	  // The image blur runs through imagePass on images instead; a device without
+	  // them runs the naive kernels.
+	  auto blurPass = [&](device_blur strategy, cl::Buffer &out, cl::Buffer &in, const int radius)
+	  {
+		  const box_divisor divide(box_samples(radius), rounding);
+		  RadiusKernels &kernels = kernelsFor(radius);
+		  // A radius whose tile does not fit in local memory falls back to the naive kernels.
+		  size_t tileW = 0, tileH = 0;
+		  if (strategy == device_blur::local && !localTile(kernels, radius, tileW, tileH))
+			  strategy = device_blur::naive;
+		  // Each pixel is one uchar4 for the RGBX kernels; the other blurs work on any channel count.
+		  if (deviceLayout == device_layout::rgbx && (strategy == device_blur::naive || strategy == device_blur::image ||
+			  strategy == device_blur::separable))
+		  {
+			  if (strategy != device_blur::separable)
+				  interiorAndBorder(radius,
+					  [&](const cl::EnqueueArgs &args) { kernels.blur_interior_rgbx(args, out, in, radius, img.w, img.h,
+						  divide.multiplier, divide.bias, divide.shift); },
+					  [&](const cl::EnqueueArgs &args) { kernels.blur_rgbx(args, out, in, radius, img.w, img.h,
+						  divide.multiplier, divide.bias, divide.shift); });
+			  else
+			  {
+				  kernels.blur_horizontal_rgbx(cl::EnqueueArgs(queue, cl::NDRange(img.w, img.h)),
+					  buffers.d_row_totals, in, radius, img.w, img.h);
+				  kernels.blur_vertical_rgbx(cl::EnqueueArgs(queue, cl::NDRange(img.w, img.h)),
+					  out, buffers.d_row_totals, radius, img.w, img.h,
+					  divide.multiplier, divide.bias, divide.shift);
+			  }
+			  return;
+		  }
+		  switch (strategy)
+		  {
+		  case device_blur::image: // only reached without image support
+		  case device_blur::naive:
+			  interiorAndBorder(radius,
+				  [&](const cl::EnqueueArgs &args) { kernels.blur_interior(args, out, in, radius, img.w, img.h, img.nchannels,
+					  divide.multiplier, divide.bias, divide.shift); },
+				  [&](const cl::EnqueueArgs &args) { kernels.blur(args, out, in, radius, img.w, img.h, img.nchannels,
+					  divide.multiplier, divide.bias, divide.shift); });
+			  break;
+		  case device_blur::local:
+			  kernels.blur_local(cl::EnqueueArgs(queue, cl::NDRange(round_up(img.w, tileW), round_up(img.h, tileH)),
+				  cl::NDRange(tileW, tileH)),
+				  out, in, radius, img.w, img.h, deviceChannels, divide.multiplier, divide.bias, divide.shift,
+				  cl::Local(local_tile_bytes(tileW, tileH, radius - 1, deviceChannels)));
+			  break;
+		  case device_blur::separable:
+			  kernels.blur_horizontal(cl::EnqueueArgs(queue, cl::NDRange(img.w, img.h)),
+				  buffers.d_row_totals, in, radius, img.w, img.h, img.nchannels);
+			  kernels.blur_vertical(cl::EnqueueArgs(queue, cl::NDRange(img.w, img.h)),
+				  out, buffers.d_row_totals, radius, img.w, img.h, img.nchannels,
+				  divide.multiplier, divide.bias, divide.shift);
+			  break;
+		  case device_blur::sliding:
+		  {
+			  const unsigned strip = sliding_strip(radius);
+			  kernels.blur_rows(cl::EnqueueArgs(queue, cl::NDRange((img.w + strip - 1) / strip, img.h)),
+				  buffers.d_row_totals, in, radius, img.w, img.h, deviceChannels, strip);
+			  kernels.blur_cols(cl::EnqueueArgs(queue, cl::NDRange(img.w, (img.h + strip - 1) / strip)),
+				  out, buffers.d_row_totals, radius, img.w, img.h, deviceChannels,
+				  divide.multiplier, divide.bias, divide.shift, strip);
+			  break;
+		  }
+		  case device_blur::integral:
+			  integral_rows(cl::EnqueueArgs(queue, cl::NDRange(img.h, deviceChannels)),
+				  buffers.d_integral, in, img.w, img.h, deviceChannels);
+			  integral_columns(cl::EnqueueArgs(queue, cl::NDRange(img.w, deviceChannels)),
+				  buffers.d_integral, img.w, img.h, deviceChannels);
+			  blur_integral(cl::EnqueueArgs(queue, cl::NDRange(img.w, img.h)),
+				  out, buffers.d_integral, radius, img.w, img.h, deviceChannels,
+				  divide.multiplier, divide.bias, divide.shift);
+			  break;
+		  }
+	  };
+
+	  if (!sweepRadii.empty())
+	  {
+		  //////////////////////////////////////////////////////////////////////////////////////////////////////
+		  //////////////////////////////// Radius sweep: one blur pass per method //////////////////////////////
+		  //////////////////////////////////////////////////////////////////////////////////////////////////////
+		  buffers.d_blurred_image1 = deviceWorkspace.buffer(device_workspace::blurred1, buffers.h_blurred_image.size());
+		  convertIn();
+		  if (imageKernels)
+			  convertInTexels();
+
+		  printSweepHeader(true);
+		  for (std::size_t r = 0; r < sweepRadii.size(); r++)
+		  {
+			  const int radius = sweepRadii[r];
+			  printHostSweep(r);
+			  // Build this radius's kernels before they are timed.
+			  kernelsFor(radius);
+			  for (const auto &entry : deviceBlurs)
+			  {
+				  if (entry.strategy == device_blur::image && !imageKernels)
+				  {
+					  std::cout << std::setw(std::strlen(entry.name) + 9) << "-";
+					  continue;
+				  }
+				  double best = 0;
+				  for (int i = 0; i < testCaseSize; i++)
+				  {
+					  auto preTimer = std::chrono::steady_clock::now();
+					  if (entry.strategy == device_blur::image)
+						  imagePass(buffers.d_blurred_texels1, buffers.d_source_texels, radius);
+					  else
+						  blurPass(entry.strategy, buffers.d_blurred_image1, d_source_image, radius);
+					  queue.finish();
+					  auto postTimer = std::chrono::steady_clock::now();
+					  double result = std::chrono::duration<double, std::ratio<1, 1000>>(postTimer - preTimer).count();
+					  best = (i == 0 || result < best) ? result : best;
+				  }
+				  std::cout << std::setw(std::strlen(entry.name) + 9) << best;
+			  }
+			  std::cout << std::endl;
+		  }
+		  return 0;
+	  }
+
+	  std::cout << "Parallel process is being cycled to filter out erroneous values, please be patient... \n" << std::endl;
+	  kernelsFor(blur_radius);
+	  if (deviceBlur == device_blur::local)
+	  {
+		  size_t tileW, tileH;
+		  if (localTile(kernelsFor(blur_radius), blur_radius, tileW, tileH))
+			  std::cout << "The local-memory blur runs " << tileW << "x" << tileH << " work-groups in "
+				  << localMemSize << " bytes of local memory.\n" << std::endl;
+		  else
+			  std::cout << "A tile of radius " << blur_radius << " does not fit in " << localMemSize
+				  << " bytes of local memory, so the naive blur runs instead.\n" << std::endl;
+	  }
+
+	  size_t fusedW = 0, fusedH = 0;
+	  const bool fused = deviceEngine == device_engine::fused
+		  && fusedTile(kernelsFor(blur_radius), blur_radius, fusedW, fusedH);
+	  if (fused)
+		  std::cout << "The fused kernel runs " << fusedW << "x" << fusedH << " work-groups in "
+			  << localMemSize << " bytes of local memory.\n" << std::endl;
+	  else if (deviceEngine == device_engine::fused)
+		  std::cout << "The fused kernel's tiles of radius " << blur_radius << " do not fit in "
+			  << localMemSize << " bytes of local memory or exceed radius " << max_fixed_radius
+			  << ", so the blur passes run instead.\n" << std::endl;
+
 	  for (int i = 0; i < (testCaseSize + testCaseIgnoreBuffer); i++)
 	  {
 			  //////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -237,65 +1165,91 @@ std::cout << "Serial process is being cycled to filter out erroneous values, ple
 
 			  auto bufferAssignmentPreTimer = std::chrono::steady_clock::now();
 
-			  //Assign buffers
-			  buffers.d_blurred_image1 = cl::Buffer(context, buffers.h_blurred_image.begin(), buffers.h_blurred_image.end(), CL_MEM_READ_WRITE, true);
-			  buffers.d_blurred_image2 = cl::Buffer(context, buffers.h_blurred_image.begin(), buffers.h_blurred_image.end(), CL_MEM_READ_WRITE, true);
+			  // Assign buffers: only the first run allocates them, and none copies host data in.
+			  buffers.d_blurred_image1 = deviceWorkspace.buffer(device_workspace::blurred1, buffers.h_blurred_image.size());
+			  buffers.d_blurred_image2 = deviceWorkspace.buffer(device_workspace::blurred2, buffers.h_blurred_image.size());
 
 			  auto bufferAssignmentPostTimer = std::chrono::steady_clock::now();
 
 			  auto kernelsPreTimer = std::chrono::steady_clock::now();
 		
-			  // Execute Blur Kernels
-				blur(
-					  cl::EnqueueArgs(
-					  queue,
-					  cl::NDRange(img.w, img.h)),
-					  buffers.d_blurred_image1,
-					  buffers.d_original_image,
-					  blur_radius,
-				      img.w,
-				      img.h,
-				      img.nchannels);
-
-				blur(
-					cl::EnqueueArgs(
-						queue,
-						cl::NDRange(img.w, img.h)),
-					buffers.d_blurred_image2,
-					buffers.d_blurred_image1,
-					blur_radius,
-					img.w,
-					img.h,
-					img.nchannels);
-
-				blur(
-					cl::EnqueueArgs(
-						queue,
-						cl::NDRange(img.w, img.h)),
-					buffers.d_blurred_image1,
-					buffers.d_blurred_image2,
-					blur_radius,
-					img.w,
-					img.h,
-					img.nchannels);
+			  if (fused)
+			  {
+				  // One launch blurs three times and adds the result to the original; the planar
+				  // and RGBX results are converted back as add_weighted's are.
+				  const box_divisor divide(box_samples(blur_radius), rounding);
+				  const size_t reach = blur_radius - 1;
+				  convertIn();
+				  kernelsFor(blur_radius).unsharp_local(cl::EnqueueArgs(queue,
+					  cl::NDRange(round_up(img.w, fusedW), round_up(img.h, fusedH)), cl::NDRange(fusedW, fusedH)),
+					  deviceLayout == device_layout::interleaved ? buffers.d_sharpened_image : buffers.d_blurred_image2,
+					  d_source_image, blur_radius, img.w, img.h, deviceChannels,
+					  divide.multiplier, divide.bias, divide.shift, imgval.alpha, imgval.beta, imgval.gamma,
+					  cl::Local(local_tile_bytes(fusedW, fusedH, 3 * reach, deviceChannels)),
+					  cl::Local(local_tile_bytes(fusedW, fusedH, 2 * reach, deviceChannels)));
+				  if (deviceLayout == device_layout::planar)
+					  interleave(cl::EnqueueArgs(queue, cl::NDRange(img.w, img.h)),
+						  buffers.d_sharpened_image, buffers.d_blurred_image2, img.w, img.h, img.nchannels);
+				  else if (deviceLayout == device_layout::rgbx)
+					  unpad_rgbx(cl::EnqueueArgs(queue, cl::NDRange(img.w, img.h)),
+						  buffers.d_sharpened_image, buffers.d_blurred_image2, img.w, img.h);
+			  }
+			  else if (deviceBlur == device_blur::image && imageKernels)
+			  {
+				  // The image blur keeps the original and both intermediates in images,
+				  // and add_weighted_image reads the last of them.
+				  convertInTexels();
+				  imagePass(buffers.d_blurred_texels1, buffers.d_source_texels, blur_radius);
+				  imagePass(buffers.d_blurred_texels2, buffers.d_blurred_texels1, blur_radius);
+				  imagePass(buffers.d_blurred_texels1, buffers.d_blurred_texels2, blur_radius);
+				  imageKernels->add_weighted_image(cl::EnqueueArgs(queue, cl::NDRange(img.w, img.h)),
+					  buffers.d_sharpened_image, buffers.d_original_image, imgval.alpha,
+					  buffers.d_blurred_texels1, imgval.beta, imgval.gamma, img.w, img.h, img.nchannels);
+			  }
+			  else
+			  {
+				  // Split the image into planes or pad it for the planar or RGBX kernels
+				  convertIn();
 
-			  //////////////////////////////////////////////////////////////////////////////////////////////////////
-			  //////////////////////////////// Blur operation finished, now Add_Weighted ///////////////////////////
-			  //////////////////////////////////////////////////////////////////////////////////////////////////////
-			  // Execute Add_Weigted Kernel
-			  add_weighted(
-				  cl::EnqueueArgs(
-					  queue,
-					  cl::NDRange(img.w, img.h)),
-				  buffers.d_sharpened_image,
-				  buffers.d_original_image,
-				  imgval.alpha,
-				  buffers.d_blurred_image1,
-				  imgval.beta,
-				  imgval.gamma,
-				  img.w,
-				  img.h,
-				  img.nchannels);
+				  // Execute Blur Kernels
+					blurPass(deviceBlur, buffers.d_blurred_image1, d_source_image, blur_radius);
+					blurPass(deviceBlur, buffers.d_blurred_image2, buffers.d_blurred_image1, blur_radius);
+					blurPass(deviceBlur, buffers.d_blurred_image1, buffers.d_blurred_image2, blur_radius);
+
+				  //////////////////////////////////////////////////////////////////////////////////////////////////////
+				  //////////////////////////////// Blur operation finished, now Add_Weighted ///////////////////////////
+				  //////////////////////////////////////////////////////////////////////////////////////////////////////
+				  // Execute Add_Weigted Kernel
+				  if (deviceLayout == device_layout::rgbx)
+				  {
+					  add_weighted_rgbx(cl::EnqueueArgs(queue, cl::NDRange(img.w, img.h)),
+						  buffers.d_blurred_image2, d_source_image, imgval.alpha,
+						  buffers.d_blurred_image1, imgval.beta, imgval.gamma, img.w, img.h);
+					  unpad_rgbx(cl::EnqueueArgs(queue, cl::NDRange(img.w, img.h)),
+						  buffers.d_sharpened_image, buffers.d_blurred_image2, img.w, img.h);
+				  }
+				  else
+				  {
+					  add_weighted(
+						  cl::EnqueueArgs(
+							  queue,
+							  cl::NDRange(img.w, img.h)),
+						  deviceLayout == device_layout::planar ? buffers.d_blurred_image2 : buffers.d_sharpened_image,
+						  d_source_image,
+						  imgval.alpha,
+						  buffers.d_blurred_image1,
+						  imgval.beta,
+						  imgval.gamma,
+						  img.w,
+						  img.h,
+						  img.nchannels);
+
+					  // add_weighted is per byte, so it ran on the planes as they were; interleave the result.
+					  if (deviceLayout == device_layout::planar)
+						  interleave(cl::EnqueueArgs(queue, cl::NDRange(img.w, img.h)),
+							  buffers.d_sharpened_image, buffers.d_blurred_image2, img.w, img.h, img.nchannels);
+				  }
+			  }
 
 			  auto kernelsPostTimer = std::chrono::steady_clock::now();
 
@@ -334,8 +1288,16 @@ std::cout << "Serial process is being cycled to filter out erroneous values, ple
 				  << std::endl;
 			  parallelExecutionAverage += parallelExecutionResult;
 
-			  // Test the results
+			  // Test the results: the integer blurs make both runs bit-identical
 			  int correct = 0;
+			  for (size_t byte = 0; byte < h_serial_image.size(); byte++)
+				  correct += h_serial_image[byte] == buffers.h_sharpened_image[byte];
+			  std::cout
+				  << correct
+				  << " of "
+				  << h_serial_image.size()
+				  << " bytes match the serial result.\n"
+				  << std::endl;
 			}
 	  }
 	  std::cout
@@ -347,6 +1309,9 @@ std::cout << "Serial process is being cycled to filter out erroneous values, ple
 		  << (parallelExecutionAverage /= testCaseSize)
 		  << " milliseconds.\n"
 		  << std::endl;
+	  std::cout << "Device workspace allocated " << deviceWorkspace.bytes_allocated() << " bytes in "
+		  << deviceWorkspace.buffers_allocated() << " buffers over " << (testCaseSize + testCaseIgnoreBuffer)
+		  << " iterations.\n" << std::endl;
 	}
   catch (cl::Error err ) {
 	  if (err.err() == CL_BUILD_PROGRAM_FAILURE)
@@ -379,6 +1344,8 @@ std::cout << "Serial process is being cycled to filter out erroneous values, ple
   }
 
   // Factor by which Parallel execution was faster than Serial execution.
+  if (parallelExecutionAverage > 0)
+  {
   double speedFactorDifference = (serialExecutionAverage /= parallelExecutionAverage);
   std::cout
 	  << "Parallel execution was "
@@ -386,11 +1353,16 @@ std::cout << "Serial process is being cycled to filter out erroneous values, ple
 	  << std::setprecision(1)
 	  << speedFactorDifference 
 	  << " Times faster than Serial execution \n" << std::endl;
+  }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////// Paralllel Execution END ////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////////////////////////////
 
+  // A sweep only times blur passes, so it has no sharpened image to write.
+  if (!sweepRadii.empty())
+	  return 0;
+
   // Write the sharpened image - to become the new picture.
   std::cout << "Writing final image to " << ofilename << "\n" << std::endl;
 
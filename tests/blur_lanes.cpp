@@ -0,0 +1,93 @@
+// Checks the sliding blurs against blur_separable() at the radii either side
+// of the 16-bit column total limit: 128 and 129 use 16-bit lanes, 130 the
+// 32-bit ones. An all-255 image takes the totals of radius 129 to exactly
+// UINT16_MAX. Every SIMD tier the host supports is run with the narrow lanes
+// both on and off, through the whole-frame blur_sliding() and through
+// blur_region() on tiles, whose 16-bit totals reuse unsigned scratch.
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "blur.hpp"
+
+static int failures = 0;
+
+static void check(const bool ok, const char *what, const int blur_radius,
+                  const unsigned nchannels, const char *image)
+{
+  if (ok) return;
+  std::fprintf(stderr, "FAIL: %s, radius %d, %u channels, %s image, %s row kernels, %s lanes\n",
+               what, blur_radius, nchannels, image,
+               simd_tier_name(active_row_kernels().tier),
+               narrow_blur_lanes() ? "narrow" : "32-bit");
+  ++failures;
+}
+
+// Blurs the image one tile at a time, as the tiled engine does, with tiles
+// smaller than the radius so that every window reaches across several.
+static image_buffer blur_tiles(const image_buffer &in, const int blur_radius,
+                               const unsigned w, const unsigned h, const unsigned nchannels,
+                               const unsigned tile)
+{
+  image_buffer out(in.size());
+  std::vector<unsigned> column_totals(w*nchannels), box_totals(w*nchannels);
+  for (unsigned y0 = 0; y0 < h; y0 += tile)
+    for (unsigned x0 = 0; x0 < w; x0 += tile) {
+      const image_region block = { nullptr, x0, y0, std::min(x0+tile, w), std::min(y0+tile, h),
+                                   0, nchannels };
+      image_region source = grow_region(block, blur_radius-1, w, h);
+      image_buffer source_pixels(source.size());
+      source.data = source_pixels.data();
+      for (unsigned y = source.y0; y < source.y1; ++y)
+        std::copy_n(&in[(y*w + source.x0)*nchannels], source.stride, source.pixel(source.x0, y));
+
+      image_region blurred = block;
+      blurred.stride = block.width()*nchannels;
+      image_buffer blurred_pixels(blurred.size());
+      blurred.data = blurred_pixels.data();
+      blur_region(blurred, source, blur_radius, w, h, column_totals.data(), box_totals.data());
+      for (unsigned y = blurred.y0; y < blurred.y1; ++y)
+        std::copy_n(blurred.pixel(blurred.x0, y), blurred.stride, &out[(y*w + blurred.x0)*nchannels]);
+    }
+  return out;
+}
+
+int main()
+{
+  if (!fits_16_bit_lanes(129)) { std::fprintf(stderr, "FAIL: radius 129 should fit 16-bit lanes\n"); ++failures; }
+  if (fits_16_bit_lanes(130))  { std::fprintf(stderr, "FAIL: radius 130 should not fit 16-bit lanes\n"); ++failures; }
+
+  const unsigned w = 301, h = 283;
+  std::mt19937 random(5);
+  const simd_tier detected = detect_simd_tier();
+  for (const unsigned nchannels : { 1u, 3u, 4u }) {
+    image_buffer white(w*h*nchannels, UCHAR_MAX), noise(w*h*nchannels);
+    for (unsigned char &byte : noise) byte = (unsigned char)random();
+
+    for (const int blur_radius : { 128, 129, 130 })
+      for (const image_buffer *in : { &white, &noise }) {
+        const char *image = in == &white ? "all-255" : "random";
+        image_buffer expected(in->size()), sliding(in->size());
+        blur_separable(expected.data(), in->data(), blur_radius, w, h, nchannels);
+
+        for (const simd_tier tier : { simd_tier::scalar, simd_tier::sse41, simd_tier::avx2 }) {
+          if (tier > detected) continue;
+          select_row_kernels(tier);
+          for (const bool narrow : { true, false }) {
+            narrow_blur_lanes() = narrow;
+            blur_sliding(sliding.data(), in->data(), blur_radius, w, h, nchannels);
+            check(sliding == expected, "blur_sliding", blur_radius, nchannels, image);
+            check(blur_tiles(*in, blur_radius, w, h, nchannels, 64) == expected,
+                  "blur_region", blur_radius, nchannels, image);
+          }
+        }
+      }
+  }
+  select_row_kernels(detected);
+  narrow_blur_lanes() = true;
+
+  if (failures) return 1;
+  std::printf("blur_lanes: all passed\n");
+  return 0;
+}
@@ -0,0 +1,148 @@
+// Checks every host engine against the frames engine, unsharp_mask(), on
+// small images whose edges are the awkward cases: a single pixel, widths and
+// heights below the radius, so every window reaches past both borders, and
+// sizes that do not divide into the engines' bands and tiles. The frames
+// engine is itself checked against three naive blur() passes into frames of
+// their own. Every SIMD tier the host supports is run.
+
+#include <cstdio>
+#include <memory>
+#include <random>
+#include "unsharp_mask.hpp"
+
+static int failures = 0;
+
+struct test_image {
+  unsigned w, h, nchannels;
+  image_buffer pixels;
+};
+
+static void check(const bool ok, const char *engine, const test_image &image, const int blur_radius)
+{
+  if (ok) return;
+  std::fprintf(stderr, "FAIL: %s, %ux%u, %u channels, radius %d, %s row kernels\n",
+               engine, image.w, image.h, image.nchannels, blur_radius,
+               simd_tier_name(active_row_kernels().tier));
+  ++failures;
+}
+
+// The unsharp mask with each blur in a frame of its own.
+static image_buffer reference_unsharp(const test_image &image, const int blur_radius,
+                                      const blur_border border = blur_border::replicate)
+{
+  const unsigned w = image.w, h = image.h, nchannels = image.nchannels;
+  image_buffer blur1(image.pixels.size()), blur2(blur1.size()), blur3(blur1.size()), out(blur1.size());
+  blur(blur1.data(), image.pixels.data(), blur_radius, w, h, nchannels, blur_method::naive,
+       blur_rounding::truncate, border);
+  blur(blur2.data(), blur1.data(),        blur_radius, w, h, nchannels, blur_method::naive,
+       blur_rounding::truncate, border);
+  blur(blur3.data(), blur2.data(),        blur_radius, w, h, nchannels, blur_method::naive,
+       blur_rounding::truncate, border);
+  add_weighted(out.data(), image.pixels.data(), 1.5f, blur3.data(), -0.5f, 0.0f, w, h, nchannels);
+  return out;
+}
+
+static const blur_method methods[] = { blur_method::naive, blur_method::sliding, blur_method::separable,
+                                       blur_method::integral, blur_method::transposed, blur_method::strided };
+
+// Pools of a few threads, more than some of the images have rows, so that
+// bands of one row and empty bands are run too.
+typedef std::vector<std::unique_ptr<thread_pool>> thread_pools;
+
+// shared is one workspace for every image, so its frames are reused at other sizes.
+static void check_engines(const test_image &image, const int blur_radius, thread_pools &pools,
+                          unsharp_workspace &shared)
+{
+  const unsigned w = image.w, h = image.h, nchannels = image.nchannels;
+  const unsigned char *in = image.pixels.data();
+  image_buffer expected(image.pixels.size()), out(image.pixels.size());
+  unsharp_mask(expected.data(), in, blur_radius, w, h, nchannels);
+  check(expected == reference_unsharp(image, blur_radius), "frames against blur()", image, blur_radius);
+
+  // The other blurs ping-pong between out and one scratch frame; the sliding
+  // blur above runs its second and third passes in place.
+  for (const blur_method method : methods) {
+    unsharp_mask(out.data(), in, blur_radius, w, h, nchannels, shared, method);
+    check(out == expected, "frames", image, blur_radius);
+  }
+  for (const blur_border border : { blur_border::reflect, blur_border::wrap, blur_border::constant }) {
+    unsharp_mask(out.data(), in, blur_radius, w, h, nchannels, shared, blur_method::naive,
+                 blur_rounding::truncate, border);
+    check(out == reference_unsharp(image, blur_radius, border), "frames with a border mode", image, blur_radius);
+  }
+
+  unsharp_mask_fused(out.data(), in, blur_radius, w, h, nchannels);
+  check(out == expected, "fused", image, blur_radius);
+
+  // The stream emits each row once, top to bottom, by the time the last row is in.
+  const unsigned row_size = w*nchannels;
+  unsigned next_row = 0;
+  bool in_order = true;
+  unsharp_stream stream(blur_radius, w, h, nchannels, [&](unsigned y, const unsigned char *row) {
+    in_order = in_order && y == next_row++;
+    std::memcpy(&out[y*row_size], row, row_size);
+  });
+  for (unsigned y = 0; y < h; ++y)
+    stream.push_row(in + y*row_size);
+  check(in_order && stream.rows_emitted() == h && out == expected, "streamed", image, blur_radius);
+
+  for (const auto &pool : pools) {
+    unsharp_mask_threaded(out.data(), in, blur_radius, w, h, nchannels, *pool);
+    check(out == expected, "threaded", image, blur_radius);
+    unsharp_mask_threaded(out.data(), in, blur_radius, w, h, nchannels, *pool, shared);
+    check(out == expected, "threaded in a shared workspace", image, blur_radius);
+  }
+
+  // Every blur runs on the planes, reusing one workspace.
+  unsharp_workspace workspace;
+  for (const blur_method method : methods) {
+    unsharp_mask_planar(out.data(), in, blur_radius, w, h, nchannels, workspace, method);
+    check(out == expected, "planar", image, blur_radius);
+  }
+
+  // Tiles of 1 and 3 pixels are smaller than most of the halos; 0 sizes them
+  // to the cache, which covers the whole of these images.
+  const unsigned tile_sizes[][2] = { { 1, 1 }, { 3, 3 }, { 1, 3 }, { 5, 2 }, { 0, 0 } };
+  for (const auto &tile : tile_sizes) {
+    unsharp_mask_tiled(out.data(), in, blur_radius, w, h, nchannels, tile[0], tile[1]);
+    check(out == expected, "tiled", image, blur_radius);
+    for (const auto &pool : pools) {
+      unsharp_mask_tiled(out.data(), in, blur_radius, w, h, nchannels, tile[0], tile[1], pool.get());
+      check(out == expected, "tiled on a pool", image, blur_radius);
+    }
+  }
+}
+
+int main()
+{
+  const unsigned sizes[][2] = { { 1, 1 }, { 1, 7 }, { 6, 1 }, { 2, 3 }, { 4, 9 },
+                                { 11, 2 }, { 13, 17 }, { 31, 5 }, { 37, 29 } };
+  std::mt19937 random(7);
+  std::vector<test_image> images;
+  for (const auto &size : sizes)
+    for (const unsigned nchannels : { 1u, 3u, 4u }) {
+      test_image image = { size[0], size[1], nchannels, image_buffer(size[0]*size[1]*nchannels) };
+      for (unsigned char &byte : image.pixels) byte = (unsigned char)random();
+      images.push_back(image);
+    }
+
+  thread_pools pools;
+  for (const unsigned nthreads : { 1u, 2u, 3u, 5u })
+    pools.emplace_back(new thread_pool(nthreads));
+
+  unsharp_workspace shared;
+
+  const simd_tier detected = detect_simd_tier();
+  for (const simd_tier tier : { simd_tier::scalar, simd_tier::sse41, simd_tier::avx2 }) {
+    if (tier > detected) continue;
+    select_row_kernels(tier);
+    for (const test_image &image : images)
+      for (const int blur_radius : { 1, 2, 3, 5, 9 })
+        check_engines(image, blur_radius, pools, shared);
+  }
+  select_row_kernels(detected);
+
+  if (failures) return 1;
+  std::printf("host_engines: all passed\n");
+  return 0;
+}